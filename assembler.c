@@ -3,6 +3,8 @@
 #include <string.h>
 #include <stdbool.h>
 #include <byteswap.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "command.h"
 #include "token.h"
@@ -28,7 +30,7 @@ void test() {
     print_inst(token_parse_line("mov Va [I] v9"));
 }
 
-OpcodeType line_to_instruction_type(char* line) {
+OpcodeType line_to_instruction_type(const char* line) {
     Instruction ins = token_parse_line(line);
     Command cmd = command_parse_opcode(ins.opcode);
     // printf("Ins: %04X\n", ins.opcode);
@@ -101,51 +103,230 @@ void set_fonts(uint8_t* binary) {
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
     };
     memcpy(binary, font_data, sizeof(font_data));
+
+    // SUPER-CHIP's big hex digits (mov HF Vx), 10 bytes each at UTIL_BIG_FONT_START
+    uint8_t big_font_data[] = {
+        0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+        0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+        0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+        0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+        0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+        0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+        0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+        0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+    memcpy(binary + UTIL_BIG_FONT_START, big_font_data, sizeof(big_font_data));
 }
 
-int main(int argc, char** argv) {
-    test_all_codes();
+// the line starting at `*cursor` without its newline (or a trailing \r), `*cursor` moves past it
+const char* next_line(const char** cursor, const char* end, size_t* length) {
+    const char* line = *cursor;
+    const char* newline = memchr(line, '\n', end - line);
+    const char* line_end = newline ? newline : end;
+    *cursor = newline ? newline + 1 : end;
 
-    if (argc < 3) {
-        printf("Usage: %s <input-asm> <output-bin>\n", argv[0]);
-        return 1;
-    }
+    if (line_end > line && line_end[-1] == '\r') line_end--;
+    *length = line_end - line;
+    return line;
+}
 
-    String input = {0};
-    if (!util_read_file(argv[1], &input)) {
-        printf("Error: Could not read file: %s\n", argv[1]);
-        return 1;
+bool is_blank(const char* line, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (line[i] != ' ') return false;
     }
+    return true;
+}
 
-    Opcodes ops = {0};
-    CString_List lines = {0};
+// Large sources are assembled in parallel: the input is cut into chunks at line
+// boundaries, each chunk gets its own opcode and warning buffers, and the buffers
+// are stitched together in chunk order afterwards. Chunks only know their local
+// line numbers until then, so nothing has to count lines ahead of the workers.
+
+#define ASM_PARALLEL_MIN_BYTES (256 * 1024) // smaller sources aren't worth starting threads for
+#define ASM_CHUNKS_PER_THREAD 8             // so a chunk of long lines doesn't hold up the rest
+
+typedef struct {
+  int* items;
+  size_t count;
+  size_t capacity;
+} LineNumbers;
+
+typedef struct {
+    const char* start;
+    const char* end;
 
-    int line_idx = 0;
-    char* line = strtok(input.items, "\n");
+    Opcodes ops;
+    LineNumbers warnings;    // local line numbers of lines that didn't parse
+    int lines;               // lines in the chunk (blank ones too)
+} AsmChunk;
 
-    while (line != NULL) {
-        Instruction ins = token_parse_line(line);
+typedef struct {
+    AsmChunk* chunks;
+    size_t chunk_count;
+    size_t next_chunk;
+    pthread_mutex_t lock;
+} AsmJob;
+
+void assemble_chunk(AsmChunk* chunk) {
+    // lines are parsed straight out of the mapping, line numbers count from 1 like an editor's
+    const char* cursor = chunk->start;
+    int line_number = 0;
+    while (cursor < chunk->end) {
+        line_number++;
+        size_t length;
+        const char* line = next_line(&cursor, chunk->end, &length);
+        if (is_blank(line, length)) continue;
+
+        Instruction ins = token_parse_slice(line, length);
         if (ins.opcode == 0) {
-            printf("Warning: Could not parse line: %d\n", line_idx);
+            util_da_append(&chunk->warnings, line_number);
         } else {
             uint16_t op = __bswap_16(ins.opcode); // swap endian-ness for big-endian in file
-            util_da_append(&ops, op);
+            util_da_append(&chunk->ops, op);
+            if (ins.opcode == 0xF000) util_da_append(&chunk->ops, __bswap_16(ins.address)); // long addr
+        }
+    }
+    chunk->lines = line_number;
+}
+
+void* assemble_worker(void* arg) {
+    AsmJob* job = arg;
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        size_t chunk = job->next_chunk++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (chunk >= job->chunk_count) return NULL;
+        assemble_chunk(&job->chunks[chunk]);
+    }
+}
+
+// cut [input, end) into about `count` chunks that each end just past a newline
+size_t split_chunks(const char* input, const char* end, size_t count, AsmChunk* chunks) {
+    size_t length = end - input;
+    size_t chunk_count = 0;
+    const char* start = input;
+    for (size_t i = 1; i <= count && start < end; i++) {
+        const char* stop = input + length * i / count;
+        if (stop < start) stop = start;
+        if (stop < end) {
+            const char* newline = memchr(stop, '\n', end - stop);
+            stop = newline ? newline + 1 : end;
         }
-        util_da_append(&lines, line);
-        line = strtok(NULL, "\n");
-        line_idx++;
+        if (i == count) stop = end;
+        if (stop == start) continue;
+
+        chunks[chunk_count++] = (AsmChunk){ .start = start, .end = stop };
+        start = stop;
+    }
+    return chunk_count;
+}
+
+// assemble the whole input on `threads` threads, warnings are printed here in line order
+void assemble(const char* input, const char* end, size_t threads, Opcodes* ops) {
+    size_t length = end - input;
+    if (length < ASM_PARALLEL_MIN_BYTES) threads = 1;
+
+    size_t max_chunks = threads == 1 ? 1 : threads * ASM_CHUNKS_PER_THREAD;
+    AsmJob job = { .chunks = calloc(max_chunks, sizeof(AsmChunk)) };
+    job.chunk_count = split_chunks(input, end, max_chunks, job.chunks);
+    if (threads > job.chunk_count) threads = job.chunk_count;
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < job.chunk_count; i++) assemble_chunk(&job.chunks[i]);
+    } else {
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_t* handles = malloc(threads * sizeof(pthread_t));
+        for (size_t t = 0; t < threads; t++) pthread_create(&handles[t], NULL, assemble_worker, &job);
+        for (size_t t = 0; t < threads; t++) pthread_join(handles[t], NULL);
+        free(handles);
+        pthread_mutex_destroy(&job.lock);
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < job.chunk_count; i++) total += job.chunks[i].ops.count;
+    ops->items = malloc((total > 0 ? total : 1) * sizeof(*ops->items));
+    ops->count = 0;
+    ops->capacity = total;
+
+    int first_line = 0; // lines before the current chunk
+    for (size_t i = 0; i < job.chunk_count; i++) {
+        AsmChunk* chunk = &job.chunks[i];
+        for (size_t w = 0; w < chunk->warnings.count; w++) {
+            printf("Warning: Could not parse line: %d\n", first_line + chunk->warnings.items[w]);
+        }
+        memcpy(ops->items + ops->count, chunk->ops.items, chunk->ops.count * sizeof(*ops->items));
+        ops->count += chunk->ops.count;
+        first_line += chunk->lines;
+
+        util_da_free(&chunk->ops);
+        util_da_free(&chunk->warnings);
+    }
+    free(job.chunks);
+}
+
+int main(int argc, char** argv) {
+    test_all_codes();
+
+    bool quiet = false;
+    size_t threads = 0;
+    const char* paths[2];
+    int path_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) quiet = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = strtoul(argv[++i], NULL, 10);
+        else if (path_count < 2) paths[path_count++] = argv[i];
+        else path_count++;
+    }
+
+    if (path_count != 2) {
+        printf("Usage: %s [-q] [-j N] <input-asm> <output-bin>\n", argv[0]);
+        printf("  -q    don't list the parsed lines and opcodes (warnings are still printed)\n");
+        printf("  -j N  assembler threads for large sources (default: one per core)\n");
+        return 1;
+    }
+
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (size_t)cores : 1;
     }
 
-    printf("\nParsed Lines:\n");
-    for (int i = 0; i < lines.count; i++) {
-        printf("%02d: %s\n", i, lines.items[i]);
+    const char* input;
+    size_t input_length;
+    if (!util_map_file(paths[0], &input, &input_length)) {
+        printf("Error: Could not read file: %s\n", paths[0]);
+        return 1;
     }
+    const char* input_end = input + input_length;
+
+    Opcodes ops = {0};
+    assemble(input, input_end, threads, &ops);
 
-    printf("\nOpcodes:\n");
-    for (int i = 0; i < ops.count; i++) {
-        uint16_t op = __bswap_16(ops.items[i]); // swap endian-ness back for printing lol
-        printf("%04X\n", op);
+    if (!quiet) {
+        printf("\nParsed Lines:\n");
+        const char* cursor = input;
+        for (int line_number = 1; cursor < input_end; line_number++) {
+            size_t length;
+            const char* line = next_line(&cursor, input_end, &length);
+            if (is_blank(line, length)) continue;
+            printf("%02d: %.*s\n", line_number, (int)length, line);
+        }
+
+        printf("\nOpcodes:\n");
+        for (int i = 0; i < ops.count; i++) {
+            uint16_t op = __bswap_16(ops.items[i]); // swap endian-ness back for printing lol
+            printf("%04X\n", op);
+        }
     }
+    util_unmap_file(input, input_length);
 
     // create binary with UTIL_INSTRUCTION_START offset
     int bin_length = UTIL_INSTRUCTION_START + ops.count * 2;
@@ -156,11 +337,12 @@ int main(int argc, char** argv) {
 
     set_fonts(binary);
 
-    if (!util_write_file(argv[2], binary, bin_length)) {
-        printf("Error: Could not write file: %s\n", argv[2]);
+    if (!util_write_file(paths[1], binary, bin_length)) {
+        printf("Error: Could not write file: %s\n", paths[1]);
         return 1;
     }
 
     free(binary);
+    util_da_free(&ops);
     return 0;
 }
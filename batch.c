@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "chip8.h"
+
+// Runs every ROM in a directory headless, one machine per ROM, spread over all cores.
+// Each worker owns a deque of jobs and takes from its bottom; a worker that runs dry
+// steals from the top of the others, so a few slow ROMs don't leave cores idle.
+
+typedef struct {
+    char* path;
+    const char* name;    // points into path
+
+    bool loaded;
+    Chip8Status status;
+    uint64_t instructions;
+    uint64_t frames;
+    uint64_t hash;
+    double seconds;
+} BatchJob;
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t* items;       // job indices
+    size_t top;          // next index thieves take
+    size_t bottom;       // one past the next index the owner takes
+} BatchQueue;
+
+typedef struct {
+    BatchJob* jobs;
+    BatchQueue* queues;
+    size_t queue_count;
+    uint64_t cycles;     // instruction budget per ROM (0 = use frames)
+    uint64_t frames;     // frame budget per ROM (0 = use cycles)
+    uint32_t instructions_per_frame;
+    uint64_t seed;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    size_t id;
+    size_t steals;
+} BatchWorker;
+
+double batch_now() {
+    return clock_now_ns() / 1e9;
+}
+
+bool batch_queue_pop(BatchQueue* queue, size_t* job) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->top < queue->bottom) {
+        *job = queue->items[--queue->bottom];
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+bool batch_queue_steal(BatchQueue* queue, size_t* job) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->top < queue->bottom) {
+        *job = queue->items[queue->top++];
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+void batch_run_job(Batch* batch, BatchJob* job, Chip8* vm) {
+    String rom = {0};
+    double start = batch_now();
+
+    if (!chip8_init(vm)) return;
+    job->loaded = util_read_file(job->path, &rom) && chip8_load(vm, rom.items, rom.count);
+    util_da_free(&rom);
+
+    if (job->loaded) {
+        vm->clock.instructions_per_frame = batch->instructions_per_frame;
+        chip8_seed(vm, batch->seed);
+        // nothing presses keys in a batch run, so waiting on mov Vx K ends it
+        if (batch->frames > 0) {
+            while (vm->clock.frames < batch->frames && vm->status == CHIP8_RUNNING) {
+                job->instructions += chip8_run_frame(vm, UINT64_MAX);
+            }
+        } else {
+            while (job->instructions < batch->cycles && vm->status == CHIP8_RUNNING) {
+                job->instructions += chip8_run_frame(vm, batch->cycles - job->instructions);
+            }
+        }
+        job->status = vm->status;
+        job->frames = vm->clock.frames;
+        job->hash = chip8_state_hash(vm);
+    }
+
+    chip8_end(vm);
+    job->seconds = batch_now() - start;
+}
+
+void* batch_worker(void* arg) {
+    BatchWorker* worker = arg;
+    Batch* batch = worker->batch;
+    Chip8* vm = malloc(sizeof(Chip8)); // too big to keep on a thread stack
+    if (vm == NULL) return NULL;
+
+    size_t job;
+    while (1) {
+        if (batch_queue_pop(&batch->queues[worker->id], &job)) {
+            batch_run_job(batch, &batch->jobs[job], vm);
+            continue;
+        }
+
+        bool stolen = false;
+        for (size_t i = 1; i < batch->queue_count && !stolen; i++) {
+            size_t victim = (worker->id + i) % batch->queue_count;
+            stolen = batch_queue_steal(&batch->queues[victim], &job);
+        }
+        if (!stolen) break; // nothing new is ever queued, so empty everywhere means done
+
+        worker->steals++;
+        batch_run_job(batch, &batch->jobs[job], vm);
+    }
+
+    free(vm);
+    return NULL;
+}
+
+int batch_compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// collect the regular files in `dir`, sorted so the report order doesn't depend on the filesystem
+bool batch_list_roms(const char* dir, CString_List* out) {
+    DIR* handle = opendir(dir);
+    if (handle == NULL) return false;
+
+    struct dirent* entry;
+    while ((entry = readdir(handle)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) continue;
+
+        size_t length = strlen(dir) + strlen(entry->d_name) + 2;
+        char* path = malloc(length);
+        snprintf(path, length, "%s/%s", dir, entry->d_name);
+        util_da_append(out, path);
+    }
+    closedir(handle);
+
+    if (out->count > 0) qsort(out->items, out->count, sizeof(*out->items), batch_compare_paths);
+    return true;
+}
+
+void usage(const char* program) {
+    printf("Usage: %s [options] <rom-dir>\n", program);
+    printf("Options:\n");
+    printf("  --cycles N     stop each ROM after N instructions\n");
+    printf("  --frames N     stop each ROM after N frames\n");
+    printf("  --ipf N        instructions per 60 Hz frame (default %d)\n", CHIP8_INSTRUCTIONS_PER_FRAME);
+    printf("  --seed N       seed for rnd Vx nn in every ROM (default %d)\n", CHIP8_DEFAULT_SEED);
+    printf("  --threads N    worker threads (default: one per core)\n");
+}
+
+int main(int argc, char** argv) {
+    const char* rom_dir = NULL;
+    size_t threads = 0;
+    Batch batch = { .instructions_per_frame = CHIP8_INSTRUCTIONS_PER_FRAME, .seed = CHIP8_DEFAULT_SEED };
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--cycles") == 0 && has_value) {
+            batch.cycles = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            batch.frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ipf") == 0 && has_value) {
+            batch.instructions_per_frame = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            batch.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            threads = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] == '-' || rom_dir != NULL) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            rom_dir = argv[i];
+        }
+    }
+
+    if (rom_dir == NULL || (batch.cycles == 0 && batch.frames == 0) || batch.instructions_per_frame == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    CString_List paths = {0};
+    if (!batch_list_roms(rom_dir, &paths)) {
+        printf("Error: Could not read directory: %s\n", rom_dir);
+        return 1;
+    }
+    if (paths.count == 0) {
+        printf("Error: No ROMs in directory: %s\n", rom_dir);
+        return 1;
+    }
+
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (size_t)cores : 1;
+    }
+    if (threads > paths.count) threads = paths.count;
+
+    BatchJob* jobs = calloc(paths.count, sizeof(BatchJob));
+    for (size_t i = 0; i < paths.count; i++) {
+        jobs[i].path = paths.items[i];
+        const char* slash = strrchr(paths.items[i], '/');
+        jobs[i].name = slash ? slash + 1 : paths.items[i];
+    }
+
+    // deal the jobs out in contiguous shards, stealing evens out whatever the split gets wrong
+    batch.jobs = jobs;
+    batch.queue_count = threads;
+    batch.queues = calloc(threads, sizeof(BatchQueue));
+    size_t* items = malloc(paths.count * sizeof(size_t));
+    for (size_t i = 0; i < paths.count; i++) items[i] = i;
+    for (size_t t = 0; t < threads; t++) {
+        BatchQueue* queue = &batch.queues[t];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->items = items;
+        queue->top = paths.count * t / threads;
+        queue->bottom = paths.count * (t + 1) / threads;
+    }
+
+    pthread_t* handles = malloc(threads * sizeof(pthread_t));
+    BatchWorker* workers = calloc(threads, sizeof(BatchWorker));
+    double start = batch_now();
+    for (size_t t = 0; t < threads; t++) {
+        workers[t] = (BatchWorker){ .batch = &batch, .id = t };
+        pthread_create(&handles[t], NULL, batch_worker, &workers[t]);
+    }
+    size_t steals = 0;
+    for (size_t t = 0; t < threads; t++) {
+        pthread_join(handles[t], NULL);
+        steals += workers[t].steals;
+    }
+    double elapsed = batch_now() - start;
+
+    uint64_t total_instructions = 0;
+    size_t failed = 0;
+    printf("%-32s %-12s %14s %10s %-16s %10s\n", "rom", "status", "instructions", "frames", "hash", "ms");
+    for (size_t i = 0; i < paths.count; i++) {
+        BatchJob* job = &jobs[i];
+        if (!job->loaded) {
+            printf("%-32s %-12s\n", job->name, "load-error");
+            failed++;
+            continue;
+        }
+        printf("%-32s %-12s %14llu %10llu %016llx %10.2f\n", job->name, chip8_status_name(job->status),
+               (unsigned long long)job->instructions, (unsigned long long)job->frames,
+               (unsigned long long)job->hash, job->seconds * 1000.0);
+        total_instructions += job->instructions;
+    }
+
+    printf("\n%zu roms (%zu failed to load) on %zu threads, %zu steals\n", paths.count, failed, threads, steals);
+    printf("%llu instructions in %.3f s, %.0f instructions/s\n",
+           (unsigned long long)total_instructions, elapsed, elapsed > 0 ? total_instructions / elapsed : 0.0);
+
+    for (size_t t = 0; t < threads; t++) pthread_mutex_destroy(&batch.queues[t].lock);
+    for (size_t i = 0; i < paths.count; i++) free(paths.items[i]);
+    util_da_free(&paths);
+    free(items);
+    free(batch.queues);
+    free(handles);
+    free(workers);
+    free(jobs);
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "util.h"
+#include "token.h"
+#include "command.h"
+#include "display.h"
+#include "chip8.h"
+#include "disasm.h"
+
+// Microbenchmarks for the hot paths. Every benchmark is warmed up, calibrated so
+// one repetition runs for at least --min-ms, then repeated --reps times; the
+// report has min/median/mean/stddev of ns per op over the repetitions.
+
+#if defined(CHIP8_JIT)
+#define BENCH_DISPATCH "jit"
+#elif defined(CHIP8_THREADED_DISPATCH)
+#define BENCH_DISPATCH "threaded"
+#else
+#define BENCH_DISPATCH "switch"
+#endif
+
+#define BENCH_MAX_REPS 1000
+#define BENCH_STEP_CHUNK 4096 // instructions per chip8_run() call in the step benchmarks
+
+typedef struct {
+    const char* name;
+    const char* unit;                         // what one op is
+    void (*run)(void* context, uint64_t iterations);
+    void* context;
+    uint64_t ops_per_iteration;
+} Bench;
+
+typedef struct {
+    const Bench* bench;
+    uint64_t iterations;                      // per repetition
+    int reps;
+    double min, median, mean, stddev;         // ns per op
+} BenchResult;
+
+volatile uint64_t bench_sink; // results go here so the work isn't optimized away
+
+// parse_opcode: every 16-bit opcode once per iteration
+void bench_parse_opcode(void* context, uint64_t iterations) {
+    (void)context;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        for (uint32_t opcode = 0; opcode < 0x10000; opcode++) {
+            Command c = command_parse_opcode(opcode);
+            sum += c.type + c.handler + c.n;
+        }
+    }
+    bench_sink = sum;
+}
+
+typedef struct {
+    Display display;
+    uint8_t sprite[15];
+    uint8_t x, y;
+} BenchSprite;
+
+// draw_sprite: one 15-row sprite per op
+void bench_draw_sprite(void* context, uint64_t iterations) {
+    BenchSprite* s = context;
+    uint64_t collisions = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        collisions += display_draw_sprite(s->display, s->x, s->y, 15, s->sprite);
+    }
+    bench_sink = collisions;
+}
+
+// a small program using every mnemonic, the way the test programs are written
+const char* bench_lines[] = {
+    "mov V0 1",      "mov V1 5",      "mov VA V3",     "mov I 768",
+    "mov V2 DT",     "mov DT V2",     "mov ST V4",     "mov F V3",
+    "mov B V3",      "mov [I] V3",    "mov V3 [I]",    "mov V5 K",
+    "add V0 5",      "add V0 V1",     "add I V1",      "sub V2 V3",
+    "subn V4 V5",    "and V6 V7",     "or V8 V9",      "xor VA VB",
+    "shr VC",        "shl VD",        "se V0 10",      "sne V0 V1",
+    "skp V2",        "sknp V3",       "rnd V4 255",    "drw V0 V1 5",
+    "call 600",      "ret",           "jmp 514",       "jmp0 700",
+    "cls",           "  mov   V1   2",
+};
+#define BENCH_LINE_COUNT (sizeof(bench_lines) / sizeof(bench_lines[0]))
+
+// token_parse_line: every line of bench_lines once per iteration
+void bench_parse_line(void* context, uint64_t iterations) {
+    (void)context;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        for (size_t l = 0; l < BENCH_LINE_COUNT; l++) {
+            sum += token_parse_line(bench_lines[l]).opcode;
+        }
+    }
+    bench_sink = sum;
+}
+
+// disasm: every 16-bit opcode's text copied out of the table once per iteration
+void bench_disasm(void* context, uint64_t iterations) {
+    (void)context;
+    char line[DISASM_TEXT_SIZE + 1];
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        for (uint32_t opcode = 0; opcode < 0x10000; opcode++) {
+            const DisasmText* text = disasm_text(opcode);
+            memcpy(line, text->text, DISASM_TEXT_SIZE);
+            sum += text->length + line[0];
+        }
+    }
+    bench_sink = sum;
+}
+
+// step: BENCH_STEP_CHUNK instructions of a looping program per iteration
+void bench_step(void* context, uint64_t iterations) {
+    Chip8* vm = context;
+    uint64_t executed = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        executed += chip8_run(vm, BENCH_STEP_CHUNK);
+    }
+    bench_sink = executed;
+}
+
+// endless loops of register arithmetic
+const uint16_t bench_alu_program[] = {
+    0x6001, // 200: mov V0 1
+    0x7101, // 202: add V1 1
+    0x8014, // 204: add V0 V1
+    0x8203, // 206: xor V2 V0
+    0x8312, // 208: and V3 V1
+    0x8421, // 20A: or V4 V2
+    0x8506, // 20C: shr V5
+    0x860E, // 20E: shl V6
+    0x8705, // 210: sub V7 V0
+    0xF11E, // 212: add I V1
+    0x1202, // 214: jmp 202
+};
+
+// counted loops, skips and calls
+const uint16_t bench_branch_program[] = {
+    0x7001, // 200: add V0 1
+    0x3080, // 202: se V0 128
+    0x1200, // 204: jmp 200
+    0x6000, // 206: mov V0 0
+    0x4101, // 208: sne V1 1
+    0x7101, // 20A: add V1 1
+    0x5120, // 20C: se V1 V2
+    0x2212, // 20E: call 212
+    0x1200, // 210: jmp 200
+    0x0000, // 212: (call lands one instruction past its target)
+    0x00EE, // 214: ret
+};
+
+// sprites all over the screen, wrapping at the edges
+const uint16_t bench_draw_program[] = {
+    0xA300, // 200: mov I 768
+    0x7003, // 202: add V0 3
+    0x7105, // 204: add V1 5
+    0xD01F, // 206: drw V0 V1 15
+    0xD105, // 208: drw V1 V0 5
+    0x1202, // 20A: jmp 202
+};
+
+void bench_load_program(Chip8* vm, const uint16_t* program, size_t count) {
+    uint8_t image[CHIP8_MEMORY_SIZE] = {0};
+    for (size_t i = 0; i < count; i++) {
+        image[UTIL_INSTRUCTION_START + 2 * i] = program[i] >> 8;
+        image[UTIL_INSTRUCTION_START + 2 * i + 1] = program[i] & 0xFF;
+    }
+    for (int i = 0; i < 16; i++) {
+        image[0x300 + i] = 0xA5 ^ (i * 0x11); // sprite data for the draw program
+    }
+    chip8_load(vm, image, sizeof(image));
+}
+
+double bench_time_ns(const Bench* bench, uint64_t iterations) {
+    uint64_t start = clock_now_ns();
+    bench->run(bench->context, iterations);
+    return (double)(clock_now_ns() - start);
+}
+
+int bench_compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+BenchResult bench_measure(const Bench* bench, int reps, double min_ns) {
+    BenchResult result = { .bench = bench, .reps = reps };
+
+    // warmup doubles as calibration: grow the iteration count until one repetition takes min_ns
+    uint64_t iterations = 1;
+    while (bench_time_ns(bench, iterations) < min_ns) {
+        iterations *= 2;
+    }
+    result.iterations = iterations;
+
+    double samples[BENCH_MAX_REPS];
+    double sum = 0;
+    for (int r = 0; r < reps; r++) {
+        samples[r] = bench_time_ns(bench, iterations) / (double)(iterations * bench->ops_per_iteration);
+        sum += samples[r];
+    }
+    qsort(samples, reps, sizeof(double), bench_compare_doubles);
+
+    result.min = samples[0];
+    result.median = reps % 2 ? samples[reps / 2] : (samples[reps / 2 - 1] + samples[reps / 2]) / 2;
+    result.mean = sum / reps;
+    double variance = 0;
+    for (int r = 0; r < reps; r++) {
+        variance += (samples[r] - result.mean) * (samples[r] - result.mean);
+    }
+    result.stddev = reps > 1 ? sqrt(variance / (reps - 1)) : 0;
+    return result;
+}
+
+void bench_print(const BenchResult* r) {
+    printf("%-24s %10.2f %10.2f %10.2f %8.2f %14.0f %s/s\n", r->bench->name, r->min, r->median, r->mean, r->stddev,
+           1e9 / r->median, r->bench->unit);
+}
+
+void bench_print_json(FILE* out, const BenchResult* results, size_t count) {
+    fprintf(out, "{\n  \"dispatch\": \"%s\",\n  \"benchmarks\": [\n", BENCH_DISPATCH);
+    for (size_t i = 0; i < count; i++) {
+        const BenchResult* r = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"reps\": %d, \"ops_per_rep\": %llu, "
+                     "\"ns_per_op\": {\"min\": %.4f, \"median\": %.4f, \"mean\": %.4f, \"stddev\": %.4f}, "
+                     "\"ops_per_sec\": %.0f}%s\n",
+                r->bench->name, r->bench->unit, r->reps,
+                (unsigned long long)(r->iterations * r->bench->ops_per_iteration),
+                r->min, r->median, r->mean, r->stddev, 1e9 / r->median, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+void usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("Options:\n");
+    printf("  --reps N       measured repetitions per benchmark (default 10, max %d)\n", BENCH_MAX_REPS);
+    printf("  --min-ms N     minimum duration of one repetition (default 50)\n");
+    printf("  --filter STR   only run benchmarks whose name contains STR\n");
+    printf("  --json FILE    also write the results as JSON to FILE (- for stdout)\n");
+}
+
+int main(int argc, char** argv) {
+    int reps = 10;
+    double min_ms = 50;
+    const char* filter = NULL;
+    const char* json_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--reps") == 0 && has_value) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--min-ms") == 0 && has_value) {
+            min_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && has_value) {
+            json_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (reps < 1 || reps > BENCH_MAX_REPS || min_ms <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    BenchSprite inside = { .x = 8, .y = 4 };
+    BenchSprite wrapping = { .x = 60, .y = 28 };
+    for (int i = 0; i < 15; i++) {
+        inside.sprite[i] = wrapping.sprite[i] = 0xF0 ^ (i * 0x1D);
+    }
+
+    Chip8* alu = malloc(sizeof(Chip8));
+    Chip8* branch = malloc(sizeof(Chip8));
+    Chip8* draw = malloc(sizeof(Chip8));
+    if (!alu || !branch || !draw || !chip8_init(alu) || !chip8_init(branch) || !chip8_init(draw)) {
+        printf("Error: Could not set up the machines\n");
+        return 1;
+    }
+    bench_load_program(alu, bench_alu_program, sizeof(bench_alu_program) / sizeof(uint16_t));
+    bench_load_program(branch, bench_branch_program, sizeof(bench_branch_program) / sizeof(uint16_t));
+    bench_load_program(draw, bench_draw_program, sizeof(bench_draw_program) / sizeof(uint16_t));
+
+    disasm_build_table();
+
+    Bench benches[] = {
+        { "parse_opcode",        "opcode", bench_parse_opcode, NULL,      0x10000 },
+        { "draw_sprite",         "sprite", bench_draw_sprite,  &inside,   1 },
+        { "draw_sprite_wrap",    "sprite", bench_draw_sprite,  &wrapping, 1 },
+        { "token_parse_line",    "line",   bench_parse_line,   NULL,      BENCH_LINE_COUNT },
+        { "disasm",              "opcode", bench_disasm,       NULL,      0x10000 },
+        { "step_alu",            "instr",  bench_step,         alu,       BENCH_STEP_CHUNK },
+        { "step_branch",         "instr",  bench_step,         branch,    BENCH_STEP_CHUNK },
+        { "step_draw",           "instr",  bench_step,         draw,      BENCH_STEP_CHUNK },
+    };
+    size_t bench_count = sizeof(benches) / sizeof(benches[0]);
+
+    BenchResult results[sizeof(benches) / sizeof(benches[0])];
+    size_t result_count = 0;
+
+    printf("dispatch: %s, %d reps of >= %.0f ms\n", BENCH_DISPATCH, reps, min_ms);
+    printf("%-24s %10s %10s %10s %8s %14s\n", "benchmark", "min ns", "median ns", "mean ns", "stddev", "throughput");
+    for (size_t i = 0; i < bench_count; i++) {
+        if (filter != NULL && strstr(benches[i].name, filter) == NULL) continue;
+        results[result_count] = bench_measure(&benches[i], reps, min_ms * 1e6);
+        bench_print(&results[result_count]);
+        result_count++;
+    }
+
+    if (json_path != NULL) {
+        FILE* out = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+        if (out == NULL) {
+            printf("Error: Could not write file: %s\n", json_path);
+            return 1;
+        }
+        bench_print_json(out, results, result_count);
+        if (out != stdout) fclose(out);
+    }
+
+    chip8_end(alu);
+    chip8_end(branch);
+    chip8_end(draw);
+    free(alu);
+    free(branch);
+    free(draw);
+    return 0;
+}
@@ -0,0 +1,1059 @@
+#ifndef CHIP8_CHIP8_H
+#define CHIP8_CHIP8_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "token.h"
+#include "command.h"
+#include "display.h"
+#include "util.h"
+#include "key.h"
+#include "clock.h"
+
+#ifdef CHIP8_JIT
+#include "jit.h"
+#endif
+
+#ifdef CHIP8_PROFILE
+#ifdef CHIP8_JIT
+#error "CHIP8_PROFILE only sees interpreted instructions, build it with the switch or threaded dispatch"
+#endif
+#include "profile.h"
+#endif
+
+#ifdef CHIP8_XOCHIP
+#if !defined(CHIP8_SCHIP)
+#error "CHIP8_XOCHIP extends SUPER-CHIP, define CHIP8_SCHIP as well"
+#endif
+#ifdef CHIP8_JIT
+#error "the JIT only translates 4 KB of memory, build CHIP8_XOCHIP with the switch or threaded dispatch"
+#endif
+#include <math.h>
+#endif
+
+// One emulated machine. Everything an instance needs lives in here so any
+// number of them can run side by side (see batch.c).
+
+#define CHIP8_MEMORY_SIZE COMMAND_MEMORY_SIZE // 4 KB, 64 KB with CHIP8_XOCHIP
+#define CHIP8_ADDRESS_MASK (CHIP8_MEMORY_SIZE - 1) // addresses past the end wrap around
+#define CHIP8_INSTRUCTIONS_PER_FRAME 11 // default, ~660 instructions per second at 60 frames per second
+#define CHIP8_DEFAULT_SEED 1
+
+typedef enum {
+    CHIP8_RUNNING = 0,
+    CHIP8_WAIT_KEY,    // mov Vx K is waiting for a key press
+    CHIP8_FAULT,       // stopped on an instruction that doesn't exist
+    CHIP8_EXITED,      // stopped by exit (SUPER-CHIP)
+} Chip8Status;
+
+typedef struct {
+    uint8_t memory[CHIP8_MEMORY_SIZE];
+    uint16_t I;              // index register (used for memory addresses)
+    uint16_t pc;             // program counter (0x200 is presumed entrypoint)
+    uint8_t registers[16];   // V0-VF registers
+    uint16_t stack[16];      // stack
+    uint8_t sp;              // stack pointer
+
+    uint8_t delay_timer;     // decremented at 60hz (once per emulated frame)
+    uint8_t sound_timer;     // decremented at 60hz (once per emulated frame)
+    uint64_t rng;            // rnd Vx nn state, part of the machine so runs can be reproduced
+
+    DisplayRow display[DISPLAY_PLANES * DISPLAY_HEIGHT]; // back buffer, cls and drw only ever change this one
+    Display frame;           // front buffer, the display as of the last complete frame (all planes ORed)
+    bool display_dirty;      // display changed since it was last copied to frame
+    uint64_t presented;      // frames that changed the front buffer
+#ifdef CHIP8_SCHIP
+    bool hires;              // 128x64 pixels, low resolution pixels are drawn 2x2
+    uint8_t rpl[16];         // RPL user flags, mov R Vx / mov Vx R
+#endif
+#ifdef CHIP8_XOCHIP
+    uint8_t planes;          // bitmask of the planes drw, cls and the scrolls apply to
+    uint8_t audio_pattern[16]; // 1 bit samples the buzzer loops over while the sound timer runs
+    uint8_t pitch;           // playback rate of audio_pattern, see chip8_audio_rate()
+#endif
+    Keypad keypad;
+    Clock clock;
+    Chip8Status status;
+
+    Command decoded[COMMAND_CACHE_SIZE]; // predecoded memory, refreshed on writes
+#ifdef CHIP8_FUSION
+    uint64_t fused_hits[FUSED_COUNT];         // times each fused handler ran
+    uint64_t fused_instructions[FUSED_COUNT]; // instructions they executed
+#endif
+#ifdef CHIP8_IDLE_SKIP
+    uint64_t idle_instructions;               // spin loop instructions fast-forwarded over
+#endif
+#ifdef CHIP8_JIT
+    Jit* jit;
+#endif
+#ifdef CHIP8_PROFILE
+    Profile* profile;
+#endif
+} Chip8;
+
+const char* chip8_status_name(Chip8Status status) {
+    switch(status) {
+        case CHIP8_RUNNING:  return "running";
+        case CHIP8_WAIT_KEY: return "waiting-key";
+        case CHIP8_FAULT:    return "fault";
+        case CHIP8_EXITED:   return "exited";
+    }
+    return "unknown";
+}
+
+void chip8_interpret_one(void* vm);
+
+// splitmix64 the seed so any seed (including 0) gives a usable xorshift state
+void chip8_seed(Chip8* vm, uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    vm->rng = z ? z : 1;
+}
+
+// xorshift64*, the top byte is the best mixed
+uint8_t chip8_random_byte(Chip8* vm) {
+    vm->rng ^= vm->rng >> 12;
+    vm->rng ^= vm->rng << 25;
+    vm->rng ^= vm->rng >> 27;
+    return (vm->rng * 0x2545F4914F6CDD1DULL) >> 56;
+}
+
+bool chip8_init(Chip8* vm) {
+    memset(vm, 0, sizeof(*vm));
+    vm->pc = UTIL_INSTRUCTION_START;
+    vm->clock.instructions_per_frame = CHIP8_INSTRUCTIONS_PER_FRAME;
+    chip8_seed(vm, CHIP8_DEFAULT_SEED);
+#ifdef CHIP8_XOCHIP
+    vm->planes = 1;
+    vm->pitch = 64; // 4000 Hz
+#endif
+    command_cache_fill(vm->decoded, vm->memory);
+#ifdef CHIP8_FUSION
+    command_cache_fuse(vm->decoded, 0, CHIP8_MEMORY_SIZE);
+#endif
+
+#ifdef CHIP8_PROFILE
+    vm->profile = malloc(sizeof(Profile));
+    if (vm->profile == NULL) return false;
+    profile_init(vm->profile, vm->pc);
+#endif
+#ifdef CHIP8_JIT
+    vm->jit = malloc(sizeof(Jit));
+    if (vm->jit == NULL) return false;
+    if (!jit_init(vm->jit, vm->memory, vm->registers, &vm->I, &vm->pc, chip8_interpret_one, vm)) {
+        free(vm->jit);
+        vm->jit = NULL;
+        return false;
+    }
+#endif
+    return true;
+}
+
+void chip8_end(Chip8* vm) {
+#ifdef CHIP8_PROFILE
+    free(vm->profile);
+    vm->profile = NULL;
+#endif
+#ifdef CHIP8_JIT
+    if (vm->jit) {
+        jit_end(vm->jit);
+        free(vm->jit);
+        vm->jit = NULL;
+    }
+#endif
+    (void)vm;
+}
+
+// copy a memory image (loaded from address 0) into the machine
+bool chip8_load(Chip8* vm, const void* data, size_t size) {
+    if (size > sizeof(vm->memory)) return false;
+
+    memcpy(vm->memory, data, size);
+    command_cache_fill(vm->decoded, vm->memory);
+#ifdef CHIP8_FUSION
+    command_cache_fuse(vm->decoded, 0, CHIP8_MEMORY_SIZE);
+#endif
+#ifdef CHIP8_JIT
+    jit_flush(vm->jit);
+#endif
+    return true;
+}
+
+// keep everything derived from memory in sync after a store of `length` bytes at `addr`
+void chip8_memory_written(Chip8* vm, uint16_t addr, uint16_t length) {
+    command_cache_invalidate(vm->decoded, vm->memory, addr, length);
+#ifdef CHIP8_FUSION
+    command_cache_fuse(vm->decoded, addr, length);
+#endif
+#ifdef CHIP8_JIT
+    jit_invalidate(vm->jit, addr, length);
+#endif
+}
+
+// the n sprite bytes at addr, copied into `wrapped` when they run past the end of memory
+const uint8_t* chip8_sprite(const Chip8* vm, uint16_t addr, uint8_t n, uint8_t* wrapped) {
+    if (addr + n <= CHIP8_MEMORY_SIZE) return vm->memory + addr;
+
+    for (int i = 0; i < n; i++) {
+        wrapped[i] = vm->memory[(addr + i) & CHIP8_ADDRESS_MASK];
+    }
+    return wrapped;
+}
+
+// bitmask of the planes drawing, clearing and scrolling apply to, just the one without CHIP8_XOCHIP
+uint8_t chip8_planes(const Chip8* vm) {
+#ifdef CHIP8_XOCHIP
+    return vm->planes;
+#else
+    (void)vm;
+    return 1;
+#endif
+}
+
+#ifdef CHIP8_SCHIP
+// drw Vx Vy 0 is a 16x16 sprite, two bytes per row. In low resolution every pixel is drawn 2x2,
+// so the sprite rows are widened and drawn twice at doubled coordinates. With both planes
+// selected (XO-CHIP) the second plane's sprite follows the first at I and one pass draws both.
+uint8_t chip8_draw_schip(Chip8* vm, uint8_t x, uint8_t y, uint8_t n) {
+    int rows = n ? n : 16;
+    int width = n ? 1 : 2;
+    int scale = vm->hires ? 1 : 2;
+    uint8_t planes = chip8_planes(vm);
+    int count = planes == 3 ? 2 : 1;
+    if (planes == 0) return 0;
+
+    uint8_t wrapped[64];
+    const uint8_t* sprite = chip8_sprite(vm, vm->I, count * rows * width, wrapped);
+    uint32_t lines[32];
+    for (int i = 0; i < count * rows; i++) {
+        uint16_t bits = width == 2 ? sprite[2 * i] << 8 | sprite[2 * i + 1] : sprite[i] << 8;
+        lines[i] = scale == 2 ? (uint32_t)display_double_bits(bits >> 8) << 16 | display_double_bits(bits & 0xFF)
+                              : (uint32_t)bits << 16;
+    }
+#ifdef CHIP8_XOCHIP
+    if (planes == 3) {
+        return display_draw_rows_both(vm->display, vm->registers[x] * scale, vm->registers[y] * scale, lines, rows, scale);
+    }
+#endif
+    return display_draw_rows(display_plane(vm->display, planes >> 1), vm->registers[x] * scale,
+                             vm->registers[y] * scale, lines, rows, scale);
+}
+#endif
+
+// drw Vx Vy n, VF = 1 on collision
+void chip8_draw(Chip8* vm, uint8_t x, uint8_t y, uint8_t n) {
+#ifdef CHIP8_SCHIP
+    // hires 8xN draws to a single plane keep the byte-wide sprite path
+    uint8_t planes = chip8_planes(vm);
+    if (!vm->hires || (n & 0xF) == 0 || (planes != 1 && planes != 2)) {
+        vm->registers[0xF] = chip8_draw_schip(vm, x, y, n & 0xF);
+        vm->display_dirty = true;
+        return;
+    }
+#else
+    uint8_t planes = 1;
+#endif
+    uint8_t wrapped[16];
+    const uint8_t* sprite = chip8_sprite(vm, vm->I, n & 0xF, wrapped);
+    vm->registers[0xF] = display_draw_sprite(display_plane(vm->display, planes >> 1), vm->registers[x],
+                                             vm->registers[y], n & 0xF, sprite);
+    vm->display_dirty = true;
+}
+
+// the back buffer as frontends show it, for the frame and for watching the drawing mid-frame
+void chip8_back_buffer(const Chip8* vm, DisplayRow* out) {
+    memcpy(out, vm->display, sizeof(Display));
+#ifdef CHIP8_XOCHIP
+    // frontends are monochrome, a pixel lit in either plane is lit
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) out[y] |= vm->display[DISPLAY_HEIGHT + y];
+#endif
+}
+
+// vblank: make the back buffer the frame frontends show, if anything was drawn since the last one
+void chip8_present(Chip8* vm) {
+    if (!vm->display_dirty) return;
+    chip8_back_buffer(vm, vm->frame);
+    vm->display_dirty = false;
+    vm->presented++;
+}
+
+// the command at pc, straight out of the decoded cache unless pc is odd
+const Command* chip8_fetch_ref(const Chip8* vm, Command* unaligned) {
+    if (vm->pc & 1) {
+        // unaligned pc straddles two cache slots, decode it directly
+        uint16_t addr = vm->pc & CHIP8_ADDRESS_MASK;
+        uint16_t opcode = vm->memory[addr] << 8 | vm->memory[(addr + 1) & CHIP8_ADDRESS_MASK]; // read big-endian 16-bit opcode
+        *unaligned = command_parse_opcode(opcode);
+        return unaligned;
+    }
+    return &vm->decoded[(vm->pc & CHIP8_ADDRESS_MASK) >> 1];
+}
+
+Command chip8_fetch(const Chip8* vm) {
+    Command unaligned;
+    return *chip8_fetch_ref(vm, &unaligned);
+}
+
+#ifdef CHIP8_XOCHIP
+// bytes a taken skip at pc steps over, 4 when the next instruction is a long I load
+uint16_t chip8_skip_length(const Chip8* vm) {
+    uint16_t next = (vm->pc + 2) & CHIP8_ADDRESS_MASK;
+    return vm->memory[next] == 0xF0 && vm->memory[(next + 1) & CHIP8_ADDRESS_MASK] == 0x00 ? 4 : 2;
+}
+
+// bits of audio_pattern the buzzer plays per second while the sound timer runs
+double chip8_audio_rate(const Chip8* vm) {
+    return 4000.0 * pow(2.0, (vm->pitch - 64) / 48.0);
+}
+#endif
+
+#ifdef CHIP8_IDLE_SKIP
+// The delay timer and the keypad only change between frames, so once one of
+// these loops goes around it keeps going until the frame is over:
+//   jmp self
+//   mov Vx DT, se/sne Vx nn, jmp back   (waiting for the delay timer)
+//   skp/sknp Vx, jmp back               (waiting for a key)
+// returns the length of the loop starting at pc if it won't exit this frame, 0 otherwise
+uint8_t chip8_idle_loop(const Chip8* vm) {
+    uint16_t pc = vm->pc;
+    if ((pc & 1) || pc > CHIP8_MEMORY_SIZE - 6) return 0; // only whole cache slots, no wrapping
+
+    const Command* c = &vm->decoded[pc >> 1];
+    switch (c->handler) {
+        case H_1NNN:
+            return c->n == pc ? 1 : 0;
+        case H_FX07: {
+            const Command* skip = c + 1;
+            const Command* jmp = c + 2;
+            if (jmp->handler != H_1NNN || jmp->n != pc) return 0;
+            if ((skip->handler != H_3XNN && skip->handler != H_4XNN) || skip->x != c->x) return 0;
+            bool equal = vm->delay_timer == (skip->n & 0xFF);
+            return equal == (skip->handler == H_3XNN) ? 0 : 3; // a taken skip leaves the loop
+        }
+        case H_EX9E:
+        case H_EXA1: {
+            const Command* jmp = c + 1;
+            if (jmp->handler != H_1NNN || jmp->n != pc) return 0;
+            bool down = key_is_down(&vm->keypad, vm->registers[c->x]);
+            return down == (c->handler == H_EX9E) ? 0 : 2;
+        }
+        default:
+            return 0;
+    }
+}
+
+// go around the `length` instruction loop at pc `rounds` times at once, returns the instructions that stands for
+uint64_t chip8_idle_skip(Chip8* vm, uint8_t length, uint64_t rounds) {
+    if (rounds == 0) return 0;
+    const Command* c = &vm->decoded[vm->pc >> 1];
+    if (c->handler == H_FX07) vm->registers[c->x] = vm->delay_timer; // all a round changes
+    vm->idle_instructions += rounds * length;
+    return rounds * length;
+}
+#endif
+
+#ifdef CHIP8_PROFILE
+#define PROFILE_INSTRUCTION(c) profile_instruction(vm->profile, vm->pc, vm->sp, *(c))
+#else
+#define PROFILE_INSTRUCTION(c)
+#endif
+
+// Both dispatch engines share the opcode bodies in chip8_interpret():
+//   switch:   OP() is a case label of a switch over the sparse OpcodeType,
+//             NEXT breaks out and the loop advances pc
+//   threaded: OP() is a label whose address sits in a table indexed by the
+//             dense HandlerIndex, NEXT advances pc and jumps straight into
+//             the next instruction's handler
+//
+// With CHIP8_FUSION a slot tagged with a fused sequence goes to its OP_FUSED()
+// handler instead, as long as the whole sequence fits in what's left of `count`
+// (otherwise it runs one instruction at a time as usual). The switch checks that
+// before it dispatches, the threaded engine jumps on c->dispatch and leaves the
+// check to FUSED_ENTRY() so plain instructions don't pay for it. The fused
+// handler runs every instruction but the last, stepping pc and `executed` for
+// each with FUSED_STEP(), and ends with NEXT for the last one.
+#ifdef CHIP8_FUSION
+#define FUSE(c) ((c)->fused != FUSED_NONE && (c)->fused_length <= count - executed)
+#define FUSED_STEP(next) do { vm->pc += 2; executed++; PROFILE_INSTRUCTION(next); } while (0)
+#define FUSED_HIT(kind, length) do { vm->fused_hits[kind]++; vm->fused_instructions[kind] += (length); } while (0)
+#define FUSED_TYPE(kind) (0x10000 + (kind)) // past every 16 bit OpcodeType
+#else
+#define FUSE(c) 0
+#endif
+// With CHIP8_IDLE_SKIP the instructions a spin loop can start with check for
+// chip8_idle_loop() and fast-forward through whole rounds of it, leaving the
+// last few instructions of `count` to run as usual.
+#ifdef CHIP8_IDLE_SKIP
+#define IDLE_SKIP() do {                                                                \
+        uint8_t length = chip8_idle_loop(vm);                                           \
+        if (length) executed += chip8_idle_skip(vm, length, (count - executed - 1) / length); \
+    } while (0)
+#else
+#define IDLE_SKIP() do {} while (0)
+#endif
+// XO-CHIP's skips go over the whole four byte long I load (F000 NNNN)
+#ifdef CHIP8_XOCHIP
+#define SKIP() (vm->pc += chip8_skip_length(vm))
+#else
+#define SKIP() (vm->pc += 2)
+#endif
+#ifdef CHIP8_THREADED_DISPATCH
+#if !defined(__GNUC__)
+#error "CHIP8_THREADED_DISPATCH needs labels-as-values (GCC or Clang)"
+#endif
+
+#define OP(type)   L_##type:
+#define OP_FUSED(kind) L_##kind:
+#define OP_NOP     L_NOP:
+#define OP_INVALID L_INVALID:
+#define DISPATCH() do { c = chip8_fetch_ref(vm, &unaligned); PROFILE_INSTRUCTION(c); goto *handlers[c->dispatch]; } while (0)
+#define FUSED_ENTRY() if (!FUSE(c)) goto *handlers[c->handler] // not enough budget left, run it unfused
+#define NEXT                                   \
+    vm->pc += 2;                               \
+    if (++executed == count) return executed;  \
+    DISPATCH()
+
+#else
+
+#define OP(type)   case type:
+#define OP_FUSED(kind) case FUSED_TYPE(kind):
+#define FUSED_ENTRY()
+#define OP_NOP     case 0:
+#define OP_INVALID default:
+#define NEXT       break
+
+#endif
+
+// interpret `count` instructions, returns the number executed
+uint64_t chip8_interpret(Chip8* vm, uint64_t count) {
+    uint64_t executed = 0;
+    const Command* c;   // points into the decoded cache, or at `unaligned`
+    Command unaligned;
+
+#ifdef CHIP8_THREADED_DISPATCH
+    static void* handlers[COMMAND_FUSED_DISPATCH(FUSED_COUNT)] = {
+        [H_NOP]  = &&L_NOP,    [H_00E0] = &&L_O_00E0, [H_00EE] = &&L_O_00EE, [H_1NNN] = &&L_O_1NNN,
+        [H_2NNN] = &&L_O_2NNN, [H_3XNN] = &&L_O_3XNN, [H_4XNN] = &&L_O_4XNN, [H_5XY0] = &&L_O_5XY0,
+        [H_6XNN] = &&L_O_6XNN, [H_7XNN] = &&L_O_7XNN, [H_8XY0] = &&L_O_8XY0, [H_8XY1] = &&L_O_8XY1,
+        [H_8XY2] = &&L_O_8XY2, [H_8XY3] = &&L_O_8XY3, [H_8XY4] = &&L_O_8XY4, [H_8XY5] = &&L_O_8XY5,
+        [H_8XY6] = &&L_O_8XY6, [H_8XY7] = &&L_O_8XY7, [H_8XYE] = &&L_O_8XYE, [H_9XY0] = &&L_O_9XY0,
+        [H_ANNN] = &&L_O_ANNN, [H_BNNN] = &&L_O_BNNN, [H_CXNN] = &&L_O_CXNN, [H_DXYN] = &&L_O_DXYN,
+        [H_EX9E] = &&L_O_EX9E, [H_EXA1] = &&L_O_EXA1, [H_FX07] = &&L_O_FX07, [H_FX0A] = &&L_O_FX0A,
+        [H_FX15] = &&L_O_FX15, [H_FX18] = &&L_O_FX18, [H_FX1E] = &&L_O_FX1E, [H_FX29] = &&L_O_FX29,
+        [H_FX33] = &&L_O_FX33, [H_FX55] = &&L_O_FX55, [H_FX65] = &&L_O_FX65, [H_INVALID] = &&L_INVALID,
+#ifdef CHIP8_SCHIP
+        [H_00CN] = &&L_O_00CN, [H_00FB] = &&L_O_00FB, [H_00FC] = &&L_O_00FC, [H_00FD] = &&L_O_00FD,
+        [H_00FE] = &&L_O_00FE, [H_00FF] = &&L_O_00FF, [H_FX30] = &&L_O_FX30, [H_FX75] = &&L_O_FX75,
+        [H_FX85] = &&L_O_FX85,
+#else
+        [H_00CN] = &&L_INVALID, [H_00FB] = &&L_INVALID, [H_00FC] = &&L_INVALID, [H_00FD] = &&L_INVALID,
+        [H_00FE] = &&L_INVALID, [H_00FF] = &&L_INVALID, [H_FX30] = &&L_INVALID, [H_FX75] = &&L_INVALID,
+        [H_FX85] = &&L_INVALID,
+#endif
+#ifdef CHIP8_XOCHIP
+        [H_00DN] = &&L_O_00DN, [H_5XY2] = &&L_O_5XY2, [H_5XY3] = &&L_O_5XY3, [H_F000] = &&L_O_F000,
+        [H_FN01] = &&L_O_FN01, [H_F002] = &&L_O_F002, [H_FX3A] = &&L_O_FX3A,
+#else
+        [H_00DN] = &&L_INVALID, [H_5XY2] = &&L_INVALID, [H_5XY3] = &&L_INVALID, [H_F000] = &&L_INVALID,
+        [H_FN01] = &&L_INVALID, [H_F002] = &&L_INVALID, [H_FX3A] = &&L_INVALID,
+#endif
+#ifdef CHIP8_FUSION
+        [COMMAND_FUSED_DISPATCH(FUSED_ANNN_DXYN)]      = &&L_FUSED_ANNN_DXYN,
+        [COMMAND_FUSED_DISPATCH(FUSED_7XNN_SKIP_1NNN)] = &&L_FUSED_7XNN_SKIP_1NNN,
+        [COMMAND_FUSED_DISPATCH(FUSED_6XNN_RUN)]       = &&L_FUSED_6XNN_RUN,
+#endif
+    };
+
+    if (count == 0) return 0;
+    DISPATCH();
+    {
+#else
+    for (; executed < count; executed++) {
+    c = chip8_fetch_ref(vm, &unaligned);
+    PROFILE_INSTRUCTION(c);
+#ifdef CHIP8_FUSION
+    switch(FUSE(c) ? FUSED_TYPE(c->fused) : (int)c->type) {
+#else
+    switch(c->type) {
+#endif
+#endif
+        // cls
+        OP(O_00E0) {
+            for (int p = 0; p < DISPLAY_PLANES; p++) {
+                if (chip8_planes(vm) >> p & 1) display_clear(display_plane(vm->display, p));
+            }
+            vm->display_dirty = true;
+            NEXT;
+        }
+        // ret
+        OP(O_00EE) {
+            vm->pc = vm->stack[vm->sp];
+            vm->sp -= 1;
+            vm->sp = (vm->sp + 16) & 0xF; // wrap around
+            NEXT;
+        }
+        // jmp nnn
+        OP(O_1NNN) {
+            if (c->n == vm->pc) IDLE_SKIP();
+            vm->pc = c->n - 2; // -2 because pc is incremented at end of step
+            NEXT;
+        }
+        // call nnn
+        OP(O_2NNN) {
+            vm->sp += 1;
+            vm->sp = (vm->sp + 16) & 0xF; // wrap around
+            vm->stack[vm->sp] = vm->pc;
+            vm->pc = c->n;
+            NEXT;
+        }
+
+        // se Vx nn
+        OP(O_3XNN) {
+            if(vm->registers[c->x] == (c->n & 0xFF)) SKIP();
+            NEXT;
+        }
+        // sne Vx nn
+        OP(O_4XNN) {
+            if(vm->registers[c->x] != (c->n & 0xFF)) SKIP();
+            NEXT;
+        }
+        // se Vx Vy
+        OP(O_5XY0) {
+            if(vm->registers[c->x] != vm->registers[c->y]) SKIP();
+            NEXT;
+        }
+
+        // mov Vx nn
+        OP(O_6XNN) {
+            vm->registers[c->x] = c->n & 0xFF;
+            NEXT;
+        }
+        // add Vx nn
+        OP(O_7XNN) {
+            vm->registers[c->x] += c->n & 0xFF;
+            NEXT;
+        }
+
+        // mov Vx Vy
+        OP(O_8XY0) {
+            vm->registers[c->x] = vm->registers[c->y];
+            NEXT;
+        }
+        // or Vx Vy
+        OP(O_8XY1) {
+            vm->registers[c->x] |= vm->registers[c->y];
+            NEXT;
+        }
+        // and Vx Vy
+        OP(O_8XY2) {
+            vm->registers[c->x] &= vm->registers[c->y];
+            NEXT;
+        }
+        // xor Vx Vy
+        OP(O_8XY3) {
+            vm->registers[c->x] ^= vm->registers[c->y];
+            NEXT;
+        }
+
+        // add Vx Vy  (VF = 1 on carry)
+        OP(O_8XY4) {
+            if(vm->registers[c->x] + vm->registers[c->y] > 0xFF) vm->registers[0xF] = 1;
+            else                                       vm->registers[0xF] = 0;
+
+            vm->registers[c->x] += vm->registers[c->y];
+            NEXT;
+        }
+        // sub Vx Vy  (VF = 0 on borrow)
+        OP(O_8XY5) {
+            if(vm->registers[c->x] >= vm->registers[c->y]) vm->registers[0xF] = 1;
+            else                                 vm->registers[0xF] = 0;
+
+            vm->registers[c->x] -= vm->registers[c->y];
+            NEXT;
+        }
+        // shr Vx  (VF = LSB)
+        OP(O_8XY6) {
+            vm->registers[0xF] = vm->registers[c->x] & 0x1; // LSB
+            vm->registers[c->x] >>= 1;
+            NEXT;
+        }
+        // subn Vx Vy  (VF = 0 on borrow)
+        OP(O_8XY7) {
+            if(vm->registers[c->y] >= vm->registers[c->x]) vm->registers[0xF] = 1;
+            else                                 vm->registers[0xF] = 0;
+
+            vm->registers[c->x] = vm->registers[c->y] - vm->registers[c->x];
+            NEXT;
+        }
+        // shl Vx  (VF = MSB)
+        OP(O_8XYE) {
+            vm->registers[0xF] = (vm->registers[c->x] >> 7) & 0x1; // MSB
+            vm->registers[c->x] <<= 1;
+            NEXT;
+        }
+
+        // sne Vx Vy
+        OP(O_9XY0) {
+            if(vm->registers[c->x] != vm->registers[c->y]) SKIP();
+            NEXT;
+        }
+
+        // mov I nnn
+        OP(O_ANNN) {
+            vm->I = c->n;
+            NEXT;
+        }
+        // jmp0 nnn
+        OP(O_BNNN) {
+            vm->pc = vm->registers[0] + c->n - 2; // -2 because pc is incremented at end of step
+            NEXT;
+        }
+
+        // rnd Vx nn
+        OP(O_CXNN) {
+            vm->registers[c->x] = chip8_random_byte(vm) & (c->n & 0xFF);
+            NEXT;
+        }
+        // drw Vx Vy n
+        OP(O_DXYN) {
+            chip8_draw(vm, c->x, c->y, c->n);
+            NEXT;
+        }
+
+        // skp Vx
+        OP(O_EX9E) {
+            IDLE_SKIP();
+            if(key_is_down(&vm->keypad, vm->registers[c->x])) SKIP();
+            NEXT;
+        }
+        // sknp Vx
+        OP(O_EXA1) {
+            IDLE_SKIP();
+            if(!key_is_down(&vm->keypad, vm->registers[c->x])) SKIP();
+            NEXT;
+        }
+
+        // mov Vx DT
+        OP(O_FX07) {
+            IDLE_SKIP();
+            vm->registers[c->x] = vm->delay_timer;
+            NEXT;
+        }
+        // mov Vx K
+        OP(O_FX0A) {
+            int key = key_take_press(&vm->keypad);
+            if (key < 0) {
+                // stay on this instruction and give up the rest of the frame until a key goes down
+                vm->status = CHIP8_WAIT_KEY;
+                return executed + 1;
+            }
+            vm->registers[c->x] = key;
+            NEXT;
+        }
+        // mov DT Vx
+        OP(O_FX15) {
+            vm->delay_timer = vm->registers[c->x];
+            NEXT;
+        }
+        // mov ST Vx
+        OP(O_FX18) {
+            vm->sound_timer = vm->registers[c->x];
+            NEXT;
+        }
+
+        // add I Vx
+        OP(O_FX1E) {
+            vm->I += vm->registers[c->x];
+            NEXT;
+        }
+        // mov I Vx
+        OP(O_FX29) {
+            vm->I = vm->registers[c->x] * 5; // 5 bytes per character
+            NEXT;
+        }
+
+        // mov B Vx
+        OP(O_FX33) {
+            vm->memory[vm->I & CHIP8_ADDRESS_MASK]       = (vm->registers[c->x] / 100) % 10;
+            vm->memory[(vm->I + 1) & CHIP8_ADDRESS_MASK] = (vm->registers[c->x] / 10) % 10;
+            vm->memory[(vm->I + 2) & CHIP8_ADDRESS_MASK] = (vm->registers[c->x]) % 10;
+            chip8_memory_written(vm, vm->I, 3);
+            NEXT;
+        }
+        // mov [I] Vx
+        OP(O_FX55) {
+            for(int i = 0; i <= c->x; i++) {
+                vm->memory[(vm->I + i) & CHIP8_ADDRESS_MASK] = vm->registers[i];
+            }
+            chip8_memory_written(vm, vm->I, c->x + 1);
+            NEXT;
+        }
+        // mov Vx [I]
+        OP(O_FX65) {
+            for(int i = 0; i <= c->x; i++) {
+                vm->registers[i] = vm->memory[(vm->I + i) & CHIP8_ADDRESS_MASK];
+            }
+            NEXT;
+        }
+
+#ifdef CHIP8_SCHIP
+        // scroll amounts are 128x64 pixels in either resolution
+
+        // scd n
+        OP(O_00CN) {
+            for (int p = 0; p < DISPLAY_PLANES; p++) {
+                if (chip8_planes(vm) >> p & 1) display_scroll_down(display_plane(vm->display, p), c->n);
+            }
+            vm->display_dirty = true;
+            NEXT;
+        }
+        // scr
+        OP(O_00FB) {
+            for (int p = 0; p < DISPLAY_PLANES; p++) {
+                if (chip8_planes(vm) >> p & 1) display_scroll_horizontal(display_plane(vm->display, p), 4, true);
+            }
+            vm->display_dirty = true;
+            NEXT;
+        }
+        // scl
+        OP(O_00FC) {
+            for (int p = 0; p < DISPLAY_PLANES; p++) {
+                if (chip8_planes(vm) >> p & 1) display_scroll_horizontal(display_plane(vm->display, p), 4, false);
+            }
+            vm->display_dirty = true;
+            NEXT;
+        }
+        // exit
+        OP(O_00FD) {
+            vm->status = CHIP8_EXITED;
+            return executed + 1;
+        }
+        // low
+        OP(O_00FE) {
+            vm->hires = false;
+            vm->display_dirty = true;
+            NEXT;
+        }
+        // high
+        OP(O_00FF) {
+            vm->hires = true;
+            vm->display_dirty = true;
+            NEXT;
+        }
+        // mov HF Vx
+        OP(O_FX30) {
+            vm->I = UTIL_BIG_FONT_START + (vm->registers[c->x] & 0xF) * 10; // 10 bytes per character
+            NEXT;
+        }
+        // mov R Vx
+        OP(O_FX75) {
+            memcpy(vm->rpl, vm->registers, c->x + 1);
+            NEXT;
+        }
+        // mov Vx R
+        OP(O_FX85) {
+            memcpy(vm->registers, vm->rpl, c->x + 1);
+            NEXT;
+        }
+#endif
+
+#ifdef CHIP8_XOCHIP
+        // scu n
+        OP(O_00DN) {
+            for (int p = 0; p < DISPLAY_PLANES; p++) {
+                if (chip8_planes(vm) >> p & 1) display_scroll_up(display_plane(vm->display, p), c->n);
+            }
+            vm->display_dirty = true;
+            NEXT;
+        }
+        // save Vx Vy  (either way round, I stays)
+        OP(O_5XY2) {
+            int step = c->x <= c->y ? 1 : -1;
+            int length = abs(c->y - c->x) + 1;
+            for (int i = 0; i < length; i++) {
+                vm->memory[(vm->I + i) & CHIP8_ADDRESS_MASK] = vm->registers[c->x + i * step];
+            }
+            chip8_memory_written(vm, vm->I, length);
+            NEXT;
+        }
+        // load Vx Vy
+        OP(O_5XY3) {
+            int step = c->x <= c->y ? 1 : -1;
+            int length = abs(c->y - c->x) + 1;
+            for (int i = 0; i < length; i++) {
+                vm->registers[c->x + i * step] = vm->memory[(vm->I + i) & CHIP8_ADDRESS_MASK];
+            }
+            NEXT;
+        }
+        // long nnnn
+        OP(O_F000) {
+            uint16_t addr = (vm->pc + 2) & CHIP8_ADDRESS_MASK;
+            vm->I = vm->memory[addr] << 8 | vm->memory[(addr + 1) & CHIP8_ADDRESS_MASK];
+            vm->pc += 2; // the address word, NEXT steps over the opcode
+            NEXT;
+        }
+        // plane n
+        OP(O_FN01) {
+            vm->planes = c->x & ((1 << DISPLAY_PLANES) - 1);
+            NEXT;
+        }
+        // audio
+        OP(O_F002) {
+            for (int i = 0; i < 16; i++) {
+                vm->audio_pattern[i] = vm->memory[(vm->I + i) & CHIP8_ADDRESS_MASK];
+            }
+            NEXT;
+        }
+        // pitch Vx
+        OP(O_FX3A) {
+            vm->pitch = vm->registers[c->x];
+            NEXT;
+        }
+#endif
+
+#ifdef CHIP8_FUSION
+        // fused commands only live in the decoded cache, the rest of the sequence follows c
+
+        // mov I nnn, drw Vx Vy n
+        OP_FUSED(FUSED_ANNN_DXYN) {
+            FUSED_ENTRY();
+            const Command* draw = c + 1;
+            vm->I = c->n;
+            FUSED_STEP(draw);
+            chip8_draw(vm, draw->x, draw->y, draw->n);
+            FUSED_HIT(FUSED_ANNN_DXYN, 2);
+            NEXT;
+        }
+        // add Vx nn, se/sne Vy nn, jmp nnn
+        OP_FUSED(FUSED_7XNN_SKIP_1NNN) {
+            FUSED_ENTRY();
+            const Command* tail = c + 1;
+            vm->registers[c->x] += c->n & 0xFF;
+            FUSED_STEP(&tail[0]);
+            bool equal = vm->registers[tail[0].x] == (tail[0].n & 0xFF);
+            if (equal == (tail[0].handler == H_3XNN)) {
+                vm->pc += 2; // skipped the jmp
+                FUSED_HIT(FUSED_7XNN_SKIP_1NNN, 2);
+            } else {
+                FUSED_STEP(&tail[1]);
+                vm->pc = tail[1].n - 2;
+                FUSED_HIT(FUSED_7XNN_SKIP_1NNN, 3);
+            }
+            NEXT;
+        }
+        // mov Vx nn, mov Vy nn, ...
+        OP_FUSED(FUSED_6XNN_RUN) {
+            FUSED_ENTRY();
+            vm->registers[c->x] = c->n & 0xFF;
+            for (int i = 1; i < c->fused_length; i++) {
+                FUSED_STEP(&c[i]);
+                vm->registers[c[i].x] = c[i].n & 0xFF;
+            }
+            FUSED_HIT(FUSED_6XNN_RUN, c->fused_length);
+            NEXT;
+        }
+#endif
+
+        OP_NOP {
+            // printf("nop: %d\n", c->type);
+            NEXT;
+        }
+        OP_INVALID {
+            // stop the machine on the instruction it doesn't know
+            vm->status = CHIP8_FAULT;
+            return executed + 1;
+        }
+    }
+#ifndef CHIP8_THREADED_DISPATCH
+    vm->pc += 2; // increment program counter one word
+    }
+#endif
+
+    return executed;
+}
+
+#undef OP
+#undef OP_FUSED
+#undef OP_NOP
+#undef OP_INVALID
+#undef NEXT
+#undef PROFILE_INSTRUCTION
+#undef FUSE
+#ifdef CHIP8_FUSION
+#undef FUSED_STEP
+#undef FUSED_HIT
+#undef FUSED_TYPE
+#endif
+#undef FUSED_ENTRY
+#undef IDLE_SKIP
+#undef SKIP
+
+#ifdef CHIP8_JIT
+void chip8_interpret_one(void* vm) {
+    chip8_interpret(vm, 1);
+}
+
+// execute `count` instructions, in translated code while the blocks fit in the budget
+uint64_t chip8_run(Chip8* vm, uint64_t count) {
+    uint64_t remaining = count;
+    while (remaining > 0 && vm->status == CHIP8_RUNNING) {
+        uint64_t left = jit_run(vm->jit, remaining);
+        if (left == remaining) left -= chip8_interpret(vm, 1);
+        remaining = left;
+    }
+    return count - remaining;
+}
+#else
+// execute `count` instructions, returns the number executed
+uint64_t chip8_run(Chip8* vm, uint64_t count) {
+    if (vm->status != CHIP8_RUNNING) return 0;
+    uint64_t executed = chip8_interpret(vm, count);
+#ifdef CHIP8_PROFILE
+    profile_pause(vm->profile); // the time until the next run isn't the last instruction's
+#endif
+    return executed;
+}
+#endif
+
+void chip8_timers_tick(Chip8* vm) {
+    if (vm->delay_timer > 0) vm->delay_timer--;
+    if (vm->sound_timer > 0) vm->sound_timer--;
+}
+
+// the end of a frame: the timers tick and the back buffer is presented
+void chip8_end_frame(Chip8* vm) {
+    chip8_timers_tick(vm);
+    chip8_present(vm);
+    vm->clock.frames++;
+}
+
+// run one 60 Hz frame worth of instructions (at most `limit`) and tick the timers once it's complete,
+// returns the number of instructions executed
+uint64_t chip8_run_frame(Chip8* vm, uint64_t limit) {
+    uint64_t executed = 0;
+    Clock* clock = &vm->clock;
+
+    if (vm->status == CHIP8_FAULT || vm->status == CHIP8_EXITED) return 0;
+    vm->status = CHIP8_RUNNING; // mov Vx K gets another look at the new key presses
+
+    if (clock->vip_timing) {
+        clock->vip_budget_us += CLOCK_FRAME_US;
+        while (clock->vip_budget_us > 0 && vm->status == CHIP8_RUNNING) {
+            if (executed == limit) return executed;
+#ifdef CHIP8_IDLE_SKIP
+            uint8_t length = chip8_idle_loop(vm);
+            if (length) {
+                // whole rounds, as long as there's budget left for the next instruction
+                int64_t round_us = 0;
+                for (int i = 0; i < length; i++) round_us += clock_vip_cost_us[vm->decoded[(vm->pc >> 1) + i].handler];
+                uint64_t rounds = (clock->vip_budget_us - 1) / round_us;
+                if (rounds > (limit - executed - 1) / length) rounds = (limit - executed - 1) / length;
+                executed += chip8_idle_skip(vm, length, rounds);
+                clock->vip_budget_us -= rounds * round_us;
+            }
+#endif
+            clock->vip_budget_us -= clock_vip_cost_us[chip8_fetch(vm).handler];
+            executed += chip8_run(vm, 1);
+        }
+    } else {
+        if (clock->instructions_per_frame > limit) return chip8_run(vm, limit);
+        executed = chip8_run(vm, clock->instructions_per_frame);
+    }
+
+    chip8_end_frame(vm);
+    return executed;
+}
+
+// hash of the complete machine state, used to compare headless runs
+uint64_t chip8_state_hash(const Chip8* vm) {
+    uint64_t hash = UTIL_FNV_OFFSET;
+    hash = util_fnv1a(hash, vm->memory, sizeof(vm->memory));
+    hash = util_fnv1a(hash, vm->registers, sizeof(vm->registers));
+    hash = util_fnv1a(hash, vm->stack, sizeof(vm->stack));
+    hash = util_fnv1a(hash, &vm->I, sizeof(vm->I));
+    hash = util_fnv1a(hash, &vm->pc, sizeof(vm->pc));
+    hash = util_fnv1a(hash, &vm->sp, sizeof(vm->sp));
+    hash = util_fnv1a(hash, &vm->delay_timer, sizeof(vm->delay_timer));
+    hash = util_fnv1a(hash, &vm->sound_timer, sizeof(vm->sound_timer));
+    hash = util_fnv1a(hash, &vm->rng, sizeof(vm->rng));
+    hash = util_fnv1a(hash, vm->display, sizeof(vm->display));
+#ifdef CHIP8_SCHIP
+    hash = util_fnv1a(hash, &vm->hires, sizeof(vm->hires));
+    hash = util_fnv1a(hash, vm->rpl, sizeof(vm->rpl));
+#endif
+#ifdef CHIP8_XOCHIP
+    hash = util_fnv1a(hash, &vm->planes, sizeof(vm->planes));
+    hash = util_fnv1a(hash, vm->audio_pattern, sizeof(vm->audio_pattern));
+    hash = util_fnv1a(hash, &vm->pitch, sizeof(vm->pitch));
+#endif
+    return hash;
+}
+
+// spin loop instructions chip8_idle_skip() went over (always 0 without CHIP8_IDLE_SKIP)
+uint64_t chip8_idle_instructions(const Chip8* vm) {
+#ifdef CHIP8_IDLE_SKIP
+    return vm->idle_instructions;
+#else
+    (void)vm;
+    return 0;
+#endif
+}
+
+// instructions that ran inside fused handlers (always 0 without CHIP8_FUSION)
+uint64_t chip8_fused_instructions(const Chip8* vm) {
+    uint64_t total = 0;
+#ifdef CHIP8_FUSION
+    for (int i = 0; i < FUSED_COUNT; i++) total += vm->fused_instructions[i];
+#else
+    (void)vm;
+#endif
+    return total;
+}
+
+void chip8_state_dump(const Chip8* vm, FILE* out, uint64_t executed) {
+    fprintf(out, "instructions: %llu\n", (unsigned long long)executed);
+    fprintf(out, "frames: %llu\n", (unsigned long long)vm->clock.frames);
+    fprintf(out, "status: %s\n", chip8_status_name(vm->status));
+#ifdef CHIP8_FUSION
+    fprintf(out, "fused: %.2f%% of instructions (", executed ? 100.0 * chip8_fused_instructions(vm) / executed : 0.0);
+    for (int i = FUSED_NONE + 1; i < FUSED_COUNT; i++) {
+        fprintf(out, "%s%s %llu hits", i > FUSED_NONE + 1 ? ", " : "", command_fused_names[i],
+                (unsigned long long)vm->fused_hits[i]);
+    }
+    fprintf(out, ")\n");
+#endif
+#ifdef CHIP8_IDLE_SKIP
+    fprintf(out, "idle: %.2f%% of instructions fast-forwarded\n",
+            executed ? 100.0 * chip8_idle_instructions(vm) / executed : 0.0);
+#endif
+    fprintf(out, "hash: %016llx\n", (unsigned long long)chip8_state_hash(vm));
+    fprintf(out, "pc: %04X\n", vm->pc);
+    fprintf(out, "I:  %04X\n", vm->I);
+    fprintf(out, "sp: %02X\n", vm->sp);
+    fprintf(out, "dt: %02X\n", vm->delay_timer);
+    fprintf(out, "st: %02X\n", vm->sound_timer);
+    fprintf(out, "rng: %016llx\n", (unsigned long long)vm->rng);
+
+    fprintf(out, "V:");
+    for (int i = 0; i < 16; i++) {
+        fprintf(out, " %02X", vm->registers[i]);
+    }
+    fprintf(out, "\nstack:");
+    for (int i = 0; i < 16; i++) {
+        fprintf(out, " %04X", vm->stack[i]);
+    }
+    fprintf(out, "\ndisplay:\n");
+    display_print(vm->display, out);
+#ifdef CHIP8_XOCHIP
+    fprintf(out, "plane 2:\n");
+    display_print(vm->display + DISPLAY_HEIGHT, out);
+#endif
+}
+
+#endif // CHIP8_CHIP8_H
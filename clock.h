@@ -0,0 +1,71 @@
+#ifndef CHIP8_CLOCK_H
+#define CHIP8_CLOCK_H
+
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "command.h"
+
+#define CLOCK_FRAME_RATE 60
+#define CLOCK_FRAME_NS (1000000000ULL / CLOCK_FRAME_RATE)
+#define CLOCK_FRAME_US (1000000 / CLOCK_FRAME_RATE)
+#define CLOCK_MAX_LAG_FRAMES 6 // further behind than this and the schedule is reset instead of caught up
+
+// approximate time each instruction takes on the COSMAC VIP interpreter, in microseconds
+const uint16_t clock_vip_cost_us[H_COUNT] = {
+    [H_NOP]  = 100,  [H_00E0] = 109,  [H_00EE] = 105,  [H_1NNN] = 105,
+    [H_2NNN] = 105,  [H_3XNN] = 55,   [H_4XNN] = 55,   [H_5XY0] = 73,
+    [H_6XNN] = 27,   [H_7XNN] = 45,   [H_8XY0] = 200,  [H_8XY1] = 200,
+    [H_8XY2] = 200,  [H_8XY3] = 200,  [H_8XY4] = 200,  [H_8XY5] = 200,
+    [H_8XY6] = 200,  [H_8XY7] = 200,  [H_8XYE] = 200,  [H_9XY0] = 73,
+    [H_ANNN] = 55,   [H_BNNN] = 105,  [H_CXNN] = 164,  [H_DXYN] = 3812,
+    [H_EX9E] = 73,   [H_EXA1] = 73,   [H_FX07] = 45,   [H_FX0A] = 45,
+    [H_FX15] = 45,   [H_FX18] = 45,   [H_FX1E] = 86,   [H_FX29] = 91,
+    [H_FX33] = 927,  [H_FX55] = 605,  [H_FX65] = 605,  [H_INVALID] = 100,
+    // SUPER-CHIP never ran on the VIP, these are guesses in line with the above
+    [H_00CN] = 109,  [H_00FB] = 109,  [H_00FC] = 109,  [H_00FD] = 100,
+    [H_00FE] = 100,  [H_00FF] = 100,  [H_FX30] = 91,   [H_FX75] = 605,
+    [H_FX85] = 605,  [H_00DN] = 109,  [H_5XY2] = 605,  [H_5XY3] = 605,
+    [H_F000] = 55,   [H_FN01] = 45,   [H_F002] = 605,  [H_FX3A] = 45,
+};
+
+typedef struct {
+    uint32_t instructions_per_frame; // used unless vip_timing is set
+    bool vip_timing;                 // spend CLOCK_FRAME_US of clock_vip_cost_us per frame instead
+    bool turbo;                      // don't wait for real time between frames
+
+    int64_t vip_budget_us;           // VIP time left over (or overspent) from the previous frame
+    uint64_t next_frame_ns;          // monotonic deadline of the next frame
+    uint64_t frames;                 // emulated frames so far
+} Clock;
+
+uint64_t clock_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void clock_start(Clock* clock) {
+    clock->next_frame_ns = clock_now_ns() + CLOCK_FRAME_NS;
+}
+
+// sleep until the next 60 Hz frame is due (returns immediately in turbo mode)
+void clock_wait_frame(Clock* clock) {
+    if (clock->turbo) return;
+
+    uint64_t now = clock_now_ns();
+    if (now < clock->next_frame_ns) {
+        struct timespec deadline = {
+            .tv_sec = clock->next_frame_ns / 1000000000ULL,
+            .tv_nsec = clock->next_frame_ns % 1000000000ULL,
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+    } else if (now - clock->next_frame_ns > CLOCK_MAX_LAG_FRAMES * CLOCK_FRAME_NS) {
+        clock->next_frame_ns = now;
+    }
+    clock->next_frame_ns += CLOCK_FRAME_NS;
+}
+
+#endif // CHIP8_CLOCK_H
@@ -7,13 +7,131 @@
 
 #include "token.h"
 
+// dense index of every OpcodeType, so dispatch tables don't have to be 64K entries
+typedef enum {
+    H_NOP = 0,
+    H_00E0,
+    H_00EE,
+    H_1NNN,
+    H_2NNN,
+    H_3XNN,
+    H_4XNN,
+    H_5XY0,
+    H_6XNN,
+    H_7XNN,
+    H_8XY0,
+    H_8XY1,
+    H_8XY2,
+    H_8XY3,
+    H_8XY4,
+    H_8XY5,
+    H_8XY6,
+    H_8XY7,
+    H_8XYE,
+    H_9XY0,
+    H_ANNN,
+    H_BNNN,
+    H_CXNN,
+    H_DXYN,
+    H_EX9E,
+    H_EXA1,
+    H_FX07,
+    H_FX0A,
+    H_FX15,
+    H_FX18,
+    H_FX1E,
+    H_FX29,
+    H_FX33,
+    H_FX55,
+    H_FX65,
+    H_00CN,    // SUPER-CHIP, these run as H_INVALID unless CHIP8_SCHIP
+    H_00FB,
+    H_00FC,
+    H_00FD,
+    H_00FE,
+    H_00FF,
+    H_FX30,
+    H_FX75,
+    H_FX85,
+    H_00DN,    // XO-CHIP, these run as H_INVALID unless CHIP8_XOCHIP
+    H_5XY2,
+    H_5XY3,
+    H_F000,
+    H_FN01,
+    H_F002,
+    H_FX3A,
+    H_INVALID, // anything the parser produced that isn't a known OpcodeType
+    H_COUNT
+} HandlerIndex;
+
 typedef struct {
     OpcodeType type; // 16 bit opcode (enum)
     uint8_t x;       // 4 bit index into register array
     uint8_t y;       // 4 bit index into register array
     uint16_t n;      // 12 bit immediate value
+    uint8_t handler; // HandlerIndex of type
+    uint8_t fused;        // FusedIndex of the sequence starting here (decoded cache only)
+    uint8_t fused_length; // most instructions the fused handler executes
+    uint8_t dispatch;     // handler, or COMMAND_FUSED_DISPATCH(fused) for threaded dispatch
 } Command;
 
+HandlerIndex command_handler_index(OpcodeType type) {
+    switch(type) {
+        case O_00E0: return H_00E0;
+        case O_00EE: return H_00EE;
+        case O_1NNN: return H_1NNN;
+        case O_2NNN: return H_2NNN;
+        case O_3XNN: return H_3XNN;
+        case O_4XNN: return H_4XNN;
+        case O_5XY0: return H_5XY0;
+        case O_6XNN: return H_6XNN;
+        case O_7XNN: return H_7XNN;
+        case O_8XY0: return H_8XY0;
+        case O_8XY1: return H_8XY1;
+        case O_8XY2: return H_8XY2;
+        case O_8XY3: return H_8XY3;
+        case O_8XY4: return H_8XY4;
+        case O_8XY5: return H_8XY5;
+        case O_8XY6: return H_8XY6;
+        case O_8XY7: return H_8XY7;
+        case O_8XYE: return H_8XYE;
+        case O_9XY0: return H_9XY0;
+        case O_ANNN: return H_ANNN;
+        case O_BNNN: return H_BNNN;
+        case O_CXNN: return H_CXNN;
+        case O_DXYN: return H_DXYN;
+        case O_EX9E: return H_EX9E;
+        case O_EXA1: return H_EXA1;
+        case O_FX07: return H_FX07;
+        case O_FX0A: return H_FX0A;
+        case O_FX15: return H_FX15;
+        case O_FX18: return H_FX18;
+        case O_FX1E: return H_FX1E;
+        case O_FX29: return H_FX29;
+        case O_FX33: return H_FX33;
+        case O_FX55: return H_FX55;
+        case O_FX65: return H_FX65;
+        case O_00CN: return H_00CN;
+        case O_00FB: return H_00FB;
+        case O_00FC: return H_00FC;
+        case O_00FD: return H_00FD;
+        case O_00FE: return H_00FE;
+        case O_00FF: return H_00FF;
+        case O_FX30: return H_FX30;
+        case O_FX75: return H_FX75;
+        case O_FX85: return H_FX85;
+        case O_00DN: return H_00DN;
+        case O_5XY2: return H_5XY2;
+        case O_5XY3: return H_5XY3;
+        case O_F000: return H_F000;
+        case O_FN01: return H_FN01;
+        case O_F002: return H_F002;
+        case O_FX3A: return H_FX3A;
+        case 0:      return H_NOP;
+        default:     return H_INVALID;
+    }
+}
+
 Command command_parse_opcode(uint16_t opcode) {
     Command c = {0};
     c.type = opcode; // the variables in opcodes will be extracted below
@@ -81,16 +199,63 @@ Command command_parse_opcode(uint16_t opcode) {
             c.type |= 0x0000; // set   _X__ (_0__)
             c.x = nibbles[1];
             c.n = (nibbles[2] << 4) | nibbles[3];
+
+            // except F000 and F002, which have no X (F100 isn't a long I load)
+            if ((c.type == O_F000 || c.type == O_F002) && c.x != 0) c.type = opcode;
             break;
         }
 
         // opcodes of the form 0x0___
-        case 0x0: break; // no variables need to be set
+        case 0x0:
+        {
+            // except 00CN and 00DN
+            if ((opcode & 0xFFF0) == 0x00C0) {
+                c.type = O_00CN;
+                c.n = nibbles[3];
+            } else if ((opcode & 0xFFF0) == 0x00D0) {
+                c.type = O_00DN;
+                c.n = nibbles[3];
+            }
+            break;
+        }
     }
 
+    c.handler = command_handler_index(c.type);
+    c.dispatch = c.handler;
     return c;
 }
 
+// memory the decoded cache covers, XO-CHIP builds have 64 KB
+#ifdef CHIP8_XOCHIP
+#define COMMAND_MEMORY_SIZE 0x10000
+#else
+#define COMMAND_MEMORY_SIZE 0x1000
+#endif
+#define COMMAND_ADDRESS_MASK (COMMAND_MEMORY_SIZE - 1)
+
+// predecoded commands, one per word slot of memory (pc >> 1)
+#define COMMAND_CACHE_SIZE (COMMAND_MEMORY_SIZE / 2)
+
+void command_cache_fill(Command* cache, uint8_t* memory) {
+    for (int i = 0; i < COMMAND_CACHE_SIZE; i++) {
+        uint16_t opcode = memory[i*2] << 8 | memory[i*2 + 1];
+        cache[i] = command_parse_opcode(opcode);
+    }
+}
+
+// re-decode every word slot touched by a write of `length` bytes at `addr`
+void command_cache_invalidate(Command* cache, uint8_t* memory, uint16_t addr, uint32_t length) {
+    if (length == 0) return;
+
+    int first = (addr & COMMAND_ADDRESS_MASK) >> 1;
+    int last = ((addr + length - 1) & COMMAND_ADDRESS_MASK) >> 1;
+    for (int i = first; ; i = (i + 1) % COMMAND_CACHE_SIZE) {
+        uint16_t opcode = memory[i*2] << 8 | memory[i*2 + 1];
+        cache[i] = command_parse_opcode(opcode);
+        if (i == last) break;
+    }
+}
+
 void command_print(Command c) {
     printf("command:\n");
     printf("  type: 0x%X\n", c.type);
@@ -105,4 +270,82 @@ void command_opcode_debug(uint16_t opcode) {
     command_print(command_parse_opcode(opcode));
 }
 
-#endif // CHIP8_COMMAND_H
+// Superinstructions: idioms the interpreter runs as one fused handler (CHIP8_FUSION).
+// Every slot is tagged with the sequence that starts at it, so a jump into the
+// middle of a sequence lands on a slot describing the rest of it. Sequences
+// never wrap past the last slot, pc would leave the cache's order there.
+typedef enum {
+    FUSED_NONE = 0,
+    FUSED_ANNN_DXYN,      // mov I nnn, drw Vx Vy n
+    FUSED_7XNN_SKIP_1NNN, // add Vx nn, se/sne Vy nn, jmp nnn (loop tails)
+    FUSED_6XNN_RUN,       // mov Vx nn, mov Vy nn, ... (register setup)
+    FUSED_COUNT
+} FusedIndex;
+
+#define COMMAND_MAX_RUN 16 // longest 6XNN run fused into one handler
+#define COMMAND_FUSED_DISPATCH(fused) (H_COUNT + (fused)) // fused handlers follow the plain ones
+
+const char* command_fused_names[FUSED_COUNT] = {
+    [FUSED_NONE]           = "none",
+    [FUSED_ANNN_DXYN]      = "ANNN+DXYN",
+    [FUSED_7XNN_SKIP_1NNN] = "7XNN+skip+1NNN",
+    [FUSED_6XNN_RUN]       = "6XNN-run",
+};
+
+// tag slot i, the slots after it have to be tagged already
+void command_fuse_slot(Command* cache, int i) {
+    Command* c = &cache[i];
+    c->fused = FUSED_NONE;
+    c->fused_length = 0;
+    c->dispatch = c->handler;
+    if (i + 1 >= COMMAND_CACHE_SIZE) return;
+
+    const Command* next = &cache[i + 1];
+    switch (c->handler) {
+        case H_ANNN: {
+            if (next->handler == H_DXYN) {
+                c->fused = FUSED_ANNN_DXYN;
+                c->fused_length = 2;
+            }
+            break;
+        }
+        case H_7XNN: {
+            if (i + 2 < COMMAND_CACHE_SIZE && (next->handler == H_3XNN || next->handler == H_4XNN) &&
+                cache[i + 2].handler == H_1NNN) {
+                c->fused = FUSED_7XNN_SKIP_1NNN;
+                c->fused_length = 3;
+            }
+            break;
+        }
+        case H_6XNN: {
+            if (next->handler == H_6XNN) {
+                int length = next->fused == FUSED_6XNN_RUN ? next->fused_length + 1 : 2;
+                c->fused = FUSED_6XNN_RUN;
+                c->fused_length = length < COMMAND_MAX_RUN ? length : COMMAND_MAX_RUN;
+            }
+            break;
+        }
+    }
+    if (c->fused != FUSED_NONE) c->dispatch = COMMAND_FUSED_DISPATCH(c->fused);
+}
+
+// retag the slots whose sequences can include a write of `length` bytes at `addr`
+void command_cache_fuse(Command* cache, uint16_t addr, uint32_t length) {
+    if (length == 0) return;
+
+    int first = (addr & COMMAND_ADDRESS_MASK) >> 1;
+    int last = ((addr + length - 1) & COMMAND_ADDRESS_MASK) >> 1;
+    if (last < first || length > COMMAND_CACHE_SIZE * 2) {
+        first = 0; // wrapped around the end, just redo all of it
+        last = COMMAND_CACHE_SIZE - 1;
+    }
+
+    // a slot's tag depends on the COMMAND_MAX_RUN - 1 slots after it
+    first -= COMMAND_MAX_RUN - 1;
+    if (first < 0) first = 0;
+    for (int i = last; i >= first; i--) {
+        command_fuse_slot(cache, i);
+    }
+}
+
+#endif //CHIP8_COMMAND_H
@@ -0,0 +1,401 @@
+#ifndef CHIP8_DEBUG_H
+#define CHIP8_DEBUG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "command.h"
+#include "key.h"
+#include "chip8.h"
+
+// Debugger: run modes, breakpoints and watchpoints.
+//
+// Free-running goes through chip8_run_frame() like any normal run, and so does
+// continuing while no breakpoint or watchpoint is set, so neither pays for the
+// debugger. Every other mode runs the frame one instruction at a time through
+// debug_run_frame(), which checks
+//   - before each instruction, the breakpoint bitmap (one bit per address) and
+//     then the predicates of the breakpoints at pc, if they have any
+//   - whether the instruction stores into a watched address (mov [I] Vx, mov B Vx, save Vx Vy)
+//   - after it, whether I was moved onto a watched address.
+// Breakpoint conditions are parsed once into a DebugPredicate, one operand of
+// the machine compared against a constant.
+
+#define DEBUG_MAX_BREAKPOINTS 64
+#define DEBUG_MAP_WORDS (CHIP8_MEMORY_SIZE / 64)
+
+typedef enum {
+    DEBUG_PAUSED = 0,
+    DEBUG_FREE_RUN,      // breakpoints and watchpoints are ignored
+    DEBUG_CONTINUE,      // run until a breakpoint or watchpoint
+    DEBUG_STEP,          // one instruction
+    DEBUG_STEP_OVER,     // one instruction, a call runs until it has returned
+    DEBUG_RUN_TO_RETURN, // until the subroutine pc is in returns
+} DebugMode;
+
+typedef enum {
+    DEBUG_STOP_NONE = 0,
+    DEBUG_STOP_STEP,        // the step, step over or run to return is done
+    DEBUG_STOP_BREAKPOINT,
+    DEBUG_STOP_WATCH_WRITE, // stop_addr is the watched address that was stored to
+    DEBUG_STOP_WATCH_I,     // I was set to the watched stop_addr
+    DEBUG_STOP_HALTED,      // the machine faulted or exited
+} DebugStop;
+
+typedef enum {
+    DEBUG_EQ = 0,
+    DEBUG_NE,
+    DEBUG_LT,
+    DEBUG_LE,
+    DEBUG_GT,
+    DEBUG_GE,
+} DebugCompare;
+
+// operands past V0-VF
+#define DEBUG_OPERAND_I  16
+#define DEBUG_OPERAND_DT 17
+#define DEBUG_OPERAND_ST 18
+#define DEBUG_OPERAND_SP 19
+
+// "V3==5", "I>=0x300", "DT!=0": an operand of the machine against a constant
+typedef struct {
+    uint8_t operand;  // 0-15 for V0-VF or one of DEBUG_OPERAND_*
+    uint8_t compare;  // DebugCompare
+    uint16_t value;
+} DebugPredicate;
+
+typedef struct {
+    uint16_t addr;
+    bool conditional;
+    DebugPredicate predicate;
+} DebugBreakpoint;
+
+typedef struct {
+    DebugMode mode;
+    uint64_t break_map[DEBUG_MAP_WORDS]; // addresses with at least one breakpoint
+    uint64_t write_map[DEBUG_MAP_WORDS]; // addresses watched for stores
+    uint64_t index_map[DEBUG_MAP_WORDS]; // addresses watched for I
+    DebugBreakpoint breakpoints[DEBUG_MAX_BREAKPOINTS];
+    int breakpoint_count;
+    int watch_count;          // watch ranges set, both maps are empty while it is 0
+
+    uint16_t target_pc;       // step over: the instruction after the call
+    uint8_t target_sp;        // step over and run to return: the stack depth to get back to
+    bool resuming;            // the next instruction runs even if it has a breakpoint
+    bool in_frame;            // debug_run_frame() stopped partway through a frame
+    uint64_t frame_executed;  // instructions run in that frame so far
+
+    DebugStop stop;           // why the last debug_run_frame() stopped
+    uint16_t stop_addr;       // breakpoint pc or watched address
+} Debugger;
+
+const char* debug_mode_name(DebugMode mode) {
+    switch (mode) {
+        case DEBUG_PAUSED:        return "paused";
+        case DEBUG_FREE_RUN:      return "free-run";
+        case DEBUG_CONTINUE:      return "continue";
+        case DEBUG_STEP:          return "step";
+        case DEBUG_STEP_OVER:     return "step-over";
+        case DEBUG_RUN_TO_RETURN: return "run-to-return";
+    }
+    return "unknown";
+}
+
+const char* debug_stop_name(DebugStop stop) {
+    switch (stop) {
+        case DEBUG_STOP_NONE:        return "";
+        case DEBUG_STOP_STEP:        return "step";
+        case DEBUG_STOP_BREAKPOINT:  return "breakpoint";
+        case DEBUG_STOP_WATCH_WRITE: return "write watch";
+        case DEBUG_STOP_WATCH_I:     return "I watch";
+        case DEBUG_STOP_HALTED:      return "halted";
+    }
+    return "unknown";
+}
+
+void debug_init(Debugger* dbg, DebugMode mode) {
+    memset(dbg, 0, sizeof(*dbg));
+    dbg->mode = mode;
+}
+
+bool debug_map_test(const uint64_t* map, uint16_t addr) {
+    addr &= CHIP8_ADDRESS_MASK;
+    return (map[addr >> 6] >> (addr & 63)) & 1;
+}
+
+void debug_map_set(uint64_t* map, uint16_t addr, bool set) {
+    addr &= CHIP8_ADDRESS_MASK;
+    if (set) map[addr >> 6] |= 1ULL << (addr & 63);
+    else     map[addr >> 6] &= ~(1ULL << (addr & 63));
+}
+
+// any of the `length` addresses from addr (wrapping like the stores do) in map
+bool debug_map_any(const uint64_t* map, uint16_t addr, int length, uint16_t* hit) {
+    for (int i = 0; i < length; i++) {
+        if (debug_map_test(map, addr + i)) {
+            *hit = (addr + i) & CHIP8_ADDRESS_MASK;
+            return true;
+        }
+    }
+    return false;
+}
+
+// anything debug_run_frame() would have to check for
+bool debug_checks(const Debugger* dbg) {
+    return dbg->breakpoint_count > 0 || dbg->watch_count > 0;
+}
+
+// the mode runs whole frames through chip8_run_frame()
+bool debug_fast(const Debugger* dbg) {
+    return dbg->mode == DEBUG_FREE_RUN || (dbg->mode == DEBUG_CONTINUE && !debug_checks(dbg));
+}
+
+// "V3==5", "I>=0x300", ... (no spaces), false if `text` isn't one
+bool debug_parse_predicate(const char* text, DebugPredicate* predicate) {
+    static const struct { const char* text; DebugCompare compare; } compares[] = {
+        { "==", DEBUG_EQ }, { "!=", DEBUG_NE }, { "<=", DEBUG_LE },
+        { ">=", DEBUG_GE }, { "<", DEBUG_LT },  { ">", DEBUG_GT },
+    };
+
+    size_t length = strcspn(text, "=!<>");
+    if (length == 2 && text[0] == 'V' && char_to_hex_val(text[1]) >= 0) predicate->operand = char_to_hex_val(text[1]);
+    else if (length == 1 && text[0] == 'I')                 predicate->operand = DEBUG_OPERAND_I;
+    else if (length == 2 && strncmp(text, "DT", 2) == 0)    predicate->operand = DEBUG_OPERAND_DT;
+    else if (length == 2 && strncmp(text, "ST", 2) == 0)    predicate->operand = DEBUG_OPERAND_ST;
+    else if (length == 2 && strncmp(text, "SP", 2) == 0)    predicate->operand = DEBUG_OPERAND_SP;
+    else return false;
+
+    const char* rest = text + length;
+    for (size_t i = 0; i < sizeof(compares) / sizeof(compares[0]); i++) {
+        size_t size = strlen(compares[i].text);
+        if (strncmp(rest, compares[i].text, size) != 0) continue;
+
+        char* end;
+        unsigned long value = strtoul(rest + size, &end, 0);
+        if (end == rest + size || *end != '\0' || value > 0xFFFF) return false;
+        predicate->compare = compares[i].compare;
+        predicate->value = value;
+        return true;
+    }
+    return false;
+}
+
+bool debug_predicate_holds(const DebugPredicate* predicate, const Chip8* vm) {
+    uint16_t a;
+    switch (predicate->operand) {
+        case DEBUG_OPERAND_I:  a = vm->I; break;
+        case DEBUG_OPERAND_DT: a = vm->delay_timer; break;
+        case DEBUG_OPERAND_ST: a = vm->sound_timer; break;
+        case DEBUG_OPERAND_SP: a = vm->sp; break;
+        default:               a = vm->registers[predicate->operand & 0xF]; break;
+    }
+    uint16_t b = predicate->value;
+    switch (predicate->compare) {
+        case DEBUG_EQ: return a == b;
+        case DEBUG_NE: return a != b;
+        case DEBUG_LT: return a < b;
+        case DEBUG_LE: return a <= b;
+        case DEBUG_GT: return a > b;
+        case DEBUG_GE: return a >= b;
+    }
+    return false;
+}
+
+// `predicate` may be NULL for an unconditional breakpoint
+bool debug_add_breakpoint(Debugger* dbg, uint16_t addr, const DebugPredicate* predicate) {
+    if (dbg->breakpoint_count == DEBUG_MAX_BREAKPOINTS) return false;
+    DebugBreakpoint* breakpoint = &dbg->breakpoints[dbg->breakpoint_count++];
+    breakpoint->addr = addr & CHIP8_ADDRESS_MASK;
+    breakpoint->conditional = predicate != NULL;
+    if (predicate) breakpoint->predicate = *predicate;
+    debug_map_set(dbg->break_map, addr, true);
+    return true;
+}
+
+// remove every breakpoint at addr, false if there wasn't one
+bool debug_remove_breakpoint(Debugger* dbg, uint16_t addr) {
+    addr &= CHIP8_ADDRESS_MASK;
+    int kept = 0;
+    for (int i = 0; i < dbg->breakpoint_count; i++) {
+        if (dbg->breakpoints[i].addr != addr) dbg->breakpoints[kept++] = dbg->breakpoints[i];
+    }
+    bool removed = kept != dbg->breakpoint_count;
+    dbg->breakpoint_count = kept;
+    debug_map_set(dbg->break_map, addr, false);
+    return removed;
+}
+
+void debug_toggle_breakpoint(Debugger* dbg, uint16_t addr) {
+    if (!debug_remove_breakpoint(dbg, addr)) debug_add_breakpoint(dbg, addr, NULL);
+}
+
+// watch stores to [first, last], or I being set into it with `index`
+void debug_watch(Debugger* dbg, uint16_t first, uint16_t last, bool index) {
+    uint64_t* map = index ? dbg->index_map : dbg->write_map;
+    for (uint32_t addr = first; addr <= last; addr++) debug_map_set(map, addr, true);
+    dbg->watch_count++;
+}
+
+// "ADDR" or "ADDR:CONDITION", e.g. "0x23A:V3==5"
+bool debug_parse_breakpoint(Debugger* dbg, const char* spec) {
+    char* end;
+    unsigned long addr = strtoul(spec, &end, 0);
+    if (end == spec || addr >= CHIP8_MEMORY_SIZE) return false;
+    if (*end == '\0') return debug_add_breakpoint(dbg, addr, NULL);
+
+    DebugPredicate predicate;
+    if (*end != ':' || !debug_parse_predicate(end + 1, &predicate)) return false;
+    return debug_add_breakpoint(dbg, addr, &predicate);
+}
+
+// "ADDR" or "FIRST-LAST"
+bool debug_parse_watch(Debugger* dbg, const char* spec, bool index) {
+    char* end;
+    unsigned long first = strtoul(spec, &end, 0);
+    unsigned long last = first;
+    if (end == spec) return false;
+    if (*end == '-') {
+        const char* from = end + 1;
+        last = strtoul(from, &end, 0);
+        if (end == from) return false;
+    }
+    if (*end != '\0' || first > last || last >= CHIP8_MEMORY_SIZE) return false;
+    debug_watch(dbg, first, last, index);
+    return true;
+}
+
+bool debug_breakpoint_hit(const Debugger* dbg, const Chip8* vm) {
+    if (!debug_map_test(dbg->break_map, vm->pc)) return false;
+    for (int i = 0; i < dbg->breakpoint_count; i++) {
+        const DebugBreakpoint* breakpoint = &dbg->breakpoints[i];
+        if (breakpoint->addr != (vm->pc & CHIP8_ADDRESS_MASK)) continue;
+        if (!breakpoint->conditional || debug_predicate_holds(&breakpoint->predicate, vm)) return true;
+    }
+    return false;
+}
+
+// the bytes `c` stores at I, 0 for everything that doesn't store
+int debug_store_length(const Command* c) {
+    switch (c->handler) {
+        case H_FX33: return 3;
+        case H_FX55: return c->x + 1;
+#ifdef CHIP8_XOCHIP
+        case H_5XY2: return abs(c->y - c->x) + 1;
+#endif
+        default:     return 0;
+    }
+}
+
+void debug_set_mode(Debugger* dbg, const Chip8* vm, DebugMode mode) {
+    if (mode == DEBUG_STEP_OVER) {
+        Command c = chip8_fetch(vm);
+        if (c.handler == H_2NNN) {
+            dbg->target_pc = vm->pc + 2;
+            dbg->target_sp = vm->sp;
+        } else {
+            mode = DEBUG_STEP; // nothing to step over
+        }
+    } else if (mode == DEBUG_RUN_TO_RETURN) {
+        dbg->target_sp = vm->sp;
+    }
+    dbg->resuming = dbg->mode == DEBUG_PAUSED && mode != DEBUG_PAUSED;
+    dbg->mode = mode;
+}
+
+// the key commands of the interactive debugger
+#define DEBUG_KEY_PAUSE     'p'
+#define DEBUG_KEY_STEP      's'
+#define DEBUG_KEY_STEP_OVER 'o'
+#define DEBUG_KEY_RETURN    'u'
+#define DEBUG_KEY_CONTINUE  'g'
+#define DEBUG_KEY_FREE_RUN  'x'
+#define DEBUG_KEY_BREAK     'k'
+
+// handle one typed key, false if it isn't a debugger command
+bool debug_command(Debugger* dbg, const Chip8* vm, char key) {
+    switch (key) {
+        case DEBUG_KEY_PAUSE:     debug_set_mode(dbg, vm, DEBUG_PAUSED); break;
+        case DEBUG_KEY_STEP:      debug_set_mode(dbg, vm, DEBUG_STEP); break;
+        case DEBUG_KEY_STEP_OVER: debug_set_mode(dbg, vm, DEBUG_STEP_OVER); break;
+        case DEBUG_KEY_RETURN:    debug_set_mode(dbg, vm, DEBUG_RUN_TO_RETURN); break;
+        case DEBUG_KEY_CONTINUE:  debug_set_mode(dbg, vm, DEBUG_CONTINUE); break;
+        case DEBUG_KEY_FREE_RUN:  debug_set_mode(dbg, vm, DEBUG_FREE_RUN); break;
+        case DEBUG_KEY_BREAK:     debug_toggle_breakpoint(dbg, vm->pc); break;
+        default:                  return false;
+    }
+    return true;
+}
+
+void debug_stop(Debugger* dbg, DebugStop stop, uint16_t addr) {
+    dbg->stop = stop;
+    dbg->stop_addr = addr;
+    dbg->mode = DEBUG_PAUSED;
+}
+
+// Run the rest of the current frame (or all of the next one) one instruction at a time, until the
+// mode's stop condition, a breakpoint or a watchpoint stops it. The frame is run and ended exactly
+// as chip8_run_frame() would, a stop in the middle just leaves the rest of it for the next call.
+// Returns the number of instructions executed.
+uint64_t debug_run_frame(Debugger* dbg, Chip8* vm) {
+    Clock* clock = &vm->clock;
+    uint64_t executed = 0;
+    dbg->stop = DEBUG_STOP_NONE;
+    if (dbg->mode == DEBUG_PAUSED) return 0;
+
+    if (!dbg->in_frame) {
+        if (vm->status == CHIP8_FAULT || vm->status == CHIP8_EXITED) {
+            debug_stop(dbg, DEBUG_STOP_HALTED, vm->pc);
+            return 0;
+        }
+        vm->status = CHIP8_RUNNING; // mov Vx K gets another look at the new key presses
+        if (clock->vip_timing) clock->vip_budget_us += CLOCK_FRAME_US;
+        dbg->frame_executed = 0;
+        dbg->in_frame = true;
+    }
+
+    bool checks = dbg->mode != DEBUG_FREE_RUN;
+    while (vm->status == CHIP8_RUNNING &&
+           (clock->vip_timing ? clock->vip_budget_us > 0 : dbg->frame_executed < clock->instructions_per_frame)) {
+        if (checks && !dbg->resuming && debug_breakpoint_hit(dbg, vm)) {
+            debug_stop(dbg, DEBUG_STOP_BREAKPOINT, vm->pc);
+            return executed;
+        }
+        dbg->resuming = false;
+
+        Command c = chip8_fetch(vm);
+        uint8_t sp = vm->sp;
+        uint16_t I = vm->I;
+        uint16_t watched = 0;
+        bool store_hit = checks && dbg->watch_count > 0 &&
+                         debug_map_any(dbg->write_map, vm->I, debug_store_length(&c), &watched);
+
+        if (clock->vip_timing) clock->vip_budget_us -= clock_vip_cost_us[c.handler];
+        executed += chip8_run(vm, 1);
+        dbg->frame_executed++;
+
+        if (store_hit) {
+            debug_stop(dbg, DEBUG_STOP_WATCH_WRITE, watched);
+        } else if (checks && dbg->watch_count > 0 && vm->I != I && debug_map_test(dbg->index_map, vm->I)) {
+            debug_stop(dbg, DEBUG_STOP_WATCH_I, vm->I);
+        } else if (dbg->mode == DEBUG_STEP ||
+                   (dbg->mode == DEBUG_STEP_OVER && vm->pc == dbg->target_pc && vm->sp == dbg->target_sp) ||
+                   (dbg->mode == DEBUG_RUN_TO_RETURN && c.handler == H_00EE && sp == dbg->target_sp)) {
+            debug_stop(dbg, DEBUG_STOP_STEP, vm->pc);
+        }
+        if (dbg->mode == DEBUG_PAUSED) break;
+    }
+
+    bool complete = vm->status != CHIP8_RUNNING ||
+                    (clock->vip_timing ? clock->vip_budget_us <= 0 : dbg->frame_executed >= clock->instructions_per_frame);
+    if (complete) {
+        chip8_end_frame(vm);
+        dbg->in_frame = false;
+    }
+    if (vm->status == CHIP8_FAULT || vm->status == CHIP8_EXITED) debug_stop(dbg, DEBUG_STOP_HALTED, vm->pc);
+    return executed;
+}
+
+#endif // CHIP8_DEBUG_H
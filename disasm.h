@@ -0,0 +1,111 @@
+#ifndef CHIP8_DISASM_H
+#define CHIP8_DISASM_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "command.h"
+
+// Opcode to assembly text, in the syntax token_parse_line() reads back.
+//
+// The text for all 64K opcodes is rendered once into a table of fixed 16 byte
+// entries, so disassembling a word is one lookup and one 16 byte copy. Words
+// that aren't instructions (0NNN other than cls/ret, 5XY1, ...) have length 0;
+// there is no syntax for raw data, so those can't be assembled back. Neither
+// can XO-CHIP's long I load (F000), its address is the next word, which one
+// table entry can't show.
+
+#define DISASM_TEXT_SIZE 15 // longest is "drw  VF VF 15"
+
+typedef struct {
+    uint8_t length;
+    char text[DISASM_TEXT_SIZE];
+} DisasmText;
+
+DisasmText disasm_table[0x10000];
+bool disasm_table_ready = false;
+
+// render one opcode, mnemonics padded to 4 like assembly.md
+int disasm_format(uint16_t opcode, char* out, size_t size) {
+    Command c = command_parse_opcode(opcode);
+    switch (c.handler) {
+        case H_00E0: return snprintf(out, size, "cls");
+        case H_00EE: return snprintf(out, size, "ret");
+        case H_1NNN: return snprintf(out, size, "jmp  %d", c.n);
+        case H_2NNN: return snprintf(out, size, "call %d", c.n);
+        case H_3XNN: return snprintf(out, size, "se   V%X %d", c.x, c.n);
+        case H_4XNN: return snprintf(out, size, "sne  V%X %d", c.x, c.n);
+        case H_5XY0: return snprintf(out, size, "se   V%X V%X", c.x, c.y);
+        case H_6XNN: return snprintf(out, size, "mov  V%X %d", c.x, c.n);
+        case H_7XNN: return snprintf(out, size, "add  V%X %d", c.x, c.n);
+        case H_8XY0: return snprintf(out, size, "mov  V%X V%X", c.x, c.y);
+        case H_8XY1: return snprintf(out, size, "or   V%X V%X", c.x, c.y);
+        case H_8XY2: return snprintf(out, size, "and  V%X V%X", c.x, c.y);
+        case H_8XY3: return snprintf(out, size, "xor  V%X V%X", c.x, c.y);
+        case H_8XY4: return snprintf(out, size, "add  V%X V%X", c.x, c.y);
+        case H_8XY5: return snprintf(out, size, "sub  V%X V%X", c.x, c.y);
+        case H_8XY7: return snprintf(out, size, "subn V%X V%X", c.x, c.y);
+        case H_8XY6: // Vy only matters to the encoding, leave it out when it's V0
+        case H_8XYE: {
+            const char* mnemonic = c.handler == H_8XY6 ? "shr" : "shl";
+            if (c.y == 0) return snprintf(out, size, "%s  V%X", mnemonic, c.x);
+            return snprintf(out, size, "%s  V%X V%X", mnemonic, c.x, c.y);
+        }
+        case H_9XY0: return snprintf(out, size, "sne  V%X V%X", c.x, c.y);
+        case H_ANNN: return snprintf(out, size, "mov  I %d", c.n);
+        case H_BNNN: return snprintf(out, size, "jmp0 %d", c.n);
+        case H_CXNN: return snprintf(out, size, "rnd  V%X %d", c.x, c.n);
+        case H_DXYN: return snprintf(out, size, "drw  V%X V%X %d", c.x, c.y, c.n);
+        case H_EX9E: return snprintf(out, size, "skp  V%X", c.x);
+        case H_EXA1: return snprintf(out, size, "sknp V%X", c.x);
+        case H_FX07: return snprintf(out, size, "mov  V%X DT", c.x);
+        case H_FX0A: return snprintf(out, size, "mov  V%X K", c.x);
+        case H_FX15: return snprintf(out, size, "mov  DT V%X", c.x);
+        case H_FX18: return snprintf(out, size, "mov  ST V%X", c.x);
+        case H_FX1E: return snprintf(out, size, "add  I V%X", c.x);
+        case H_FX29: return snprintf(out, size, "mov  F V%X", c.x);
+        case H_FX33: return snprintf(out, size, "mov  B V%X", c.x);
+        case H_FX55: return snprintf(out, size, "mov  [I] V%X", c.x);
+        case H_FX65: return snprintf(out, size, "mov  V%X [I]", c.x);
+        case H_00CN: return snprintf(out, size, "scd  %d", c.n);
+        case H_00FB: return snprintf(out, size, "scr");
+        case H_00FC: return snprintf(out, size, "scl");
+        case H_00FD: return snprintf(out, size, "exit");
+        case H_00FE: return snprintf(out, size, "low");
+        case H_00FF: return snprintf(out, size, "high");
+        case H_FX30: return snprintf(out, size, "mov  HF V%X", c.x);
+        case H_FX75: return snprintf(out, size, "mov  R V%X", c.x);
+        case H_FX85: return snprintf(out, size, "mov  V%X R", c.x);
+        case H_00DN: return snprintf(out, size, "scu  %d", c.n);
+        case H_5XY2: return snprintf(out, size, "save V%X V%X", c.x, c.y);
+        case H_5XY3: return snprintf(out, size, "load V%X V%X", c.x, c.y);
+        case H_FN01: return snprintf(out, size, "plane %d", c.x);
+        case H_F002: return snprintf(out, size, "audio");
+        case H_FX3A: return snprintf(out, size, "pitch V%X", c.x);
+        default: // H_NOP, H_INVALID, H_F000
+            if (size > 0) out[0] = '\0';
+            return 0;
+    }
+}
+
+void disasm_build_table() {
+    if (disasm_table_ready) return;
+    char text[32];
+    for (uint32_t opcode = 0; opcode < 0x10000; opcode++) {
+        int length = disasm_format(opcode, text, sizeof(text));
+        assert(length <= DISASM_TEXT_SIZE && "DISASM_TEXT_SIZE is too small");
+        disasm_table[opcode].length = length;
+        memcpy(disasm_table[opcode].text, text, length);
+    }
+    disasm_table_ready = true;
+}
+
+// the table entry for `opcode`, disasm_build_table() has to have run
+const DisasmText* disasm_text(uint16_t opcode) {
+    return &disasm_table[opcode];
+}
+
+#endif // CHIP8_DISASM_H
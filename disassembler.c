@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "token.h"
+#include "command.h"
+#include "disasm.h"
+
+// Disassembles ROMs into the syntax chip8asm reads, or with --verify checks that
+// every instruction word survives token_parse_slice(disasm(word)) unchanged.
+//
+// A ROM file is a memory image, chip8 loads it at address 0 and starts at 0x200,
+// so that is where disassembly starts. --base moves the file in memory, e.g.
+// --base 0x200 for ROMs built for interpreters that load them at 0x200.
+
+#define DIS_OUT_SIZE (64 * 1024)
+#define DIS_MAX_MISMATCHES 20 // reported per file, all of them are counted
+
+typedef struct {
+    char items[DIS_OUT_SIZE];
+    size_t count;
+} DisOut;
+
+typedef struct {
+    uint64_t words;
+    uint64_t instructions;
+    uint64_t data;          // words (and a trailing odd byte) that aren't instructions
+    uint64_t mismatches;
+} DisStats;
+
+const char dis_hex_digits[] = "0123456789ABCDEF";
+
+void dis_flush(DisOut* out) {
+    fwrite(out->items, 1, out->count, stdout);
+    out->count = 0;
+}
+
+// room for one more listing line
+void dis_reserve(DisOut* out) {
+    if (out->count + 64 > DIS_OUT_SIZE) dis_flush(out);
+}
+
+void dis_put_hex(DisOut* out, uint32_t value, int digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        out->items[out->count++] = dis_hex_digits[(value >> (4 * i)) & 0xF];
+    }
+}
+
+// "0x200  6001  mov  V0 1"
+void dis_list_word(DisOut* out, uint32_t addr, uint16_t word) {
+    const DisasmText* text = disasm_text(word);
+    dis_reserve(out);
+    out->items[out->count++] = '0';
+    out->items[out->count++] = 'x';
+    int digits = 3;
+    while (digits < 8 && (addr >> (4 * digits)) != 0) digits++;
+    dis_put_hex(out, addr, digits);
+    memcpy(out->items + out->count, "  ", 2);
+    out->count += 2;
+    dis_put_hex(out, word, 4);
+    if (text->length > 0) {
+        memcpy(out->items + out->count, "  ", 2);
+        out->count += 2;
+        memcpy(out->items + out->count, text->text, DISASM_TEXT_SIZE); // fixed size copy, only `length` is kept
+        out->count += text->length;
+    }
+    out->items[out->count++] = '\n';
+}
+
+void dis_list(DisOut* out, const uint8_t* rom, size_t size, uint32_t base, uint32_t start) {
+    size_t offset = start > base ? start - base : 0;
+    for (; offset + 1 < size; offset += 2) {
+        dis_list_word(out, base + offset, rom[offset] << 8 | rom[offset + 1]);
+    }
+    if (offset < size) {
+        dis_reserve(out);
+        out->count += snprintf(out->items + out->count, 64, "0x%03X  %02X\n", (unsigned)(base + offset), rom[offset]);
+    }
+}
+
+void dis_verify(const char* path, const uint8_t* rom, size_t size, uint32_t base, uint32_t start, DisStats* stats) {
+    size_t offset = start > base ? start - base : 0;
+    for (; offset + 1 < size; offset += 2) {
+        uint16_t word = rom[offset] << 8 | rom[offset + 1];
+        const DisasmText* text = disasm_text(word);
+        stats->words++;
+        if (text->length == 0) {
+            stats->data++;
+            continue;
+        }
+
+        stats->instructions++;
+        Instruction ins = token_parse_slice(text->text, text->length);
+        if (ins.opcode != word) {
+            if (stats->mismatches < DIS_MAX_MISMATCHES) {
+                printf("%s: 0x%03X  %04X -> %.*s -> %04X\n", path, (unsigned)(base + offset), word,
+                       text->length, text->text, ins.opcode);
+            }
+            stats->mismatches++;
+        }
+    }
+    if (offset < size) stats->data++;
+}
+
+void usage(const char* program) {
+    printf("Usage: %s [options] <rom>...\n", program);
+    printf("Options:\n");
+    printf("  --verify     check that every instruction reassembles to the same word instead of listing\n");
+    printf("  --base ADDR  address the first byte of the file is loaded at (default 0)\n");
+    printf("  --start ADDR first address to disassemble (default 0x%X)\n", UTIL_INSTRUCTION_START);
+}
+
+int main(int argc, char** argv) {
+    bool verify = false;
+    uint32_t base = 0;
+    uint32_t start = UTIL_INSTRUCTION_START;
+    CString_List roms = {0};
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        } else if (strcmp(argv[i], "--base") == 0 && has_value) {
+            base = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--start") == 0 && has_value) {
+            start = strtoul(argv[++i], NULL, 0);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            util_da_append(&roms, argv[i]);
+        }
+    }
+
+    if (roms.count == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    disasm_build_table();
+
+    static DisOut out; // too big for the stack
+    DisStats total = {0};
+    size_t failed = 0;
+    for (size_t i = 0; i < roms.count; i++) {
+        const char* data;
+        size_t size;
+        if (!util_map_file(roms.items[i], &data, &size)) {
+            dis_flush(&out);
+            printf("Error: Could not read file: %s\n", roms.items[i]);
+            failed++;
+            continue;
+        }
+
+        if (verify) {
+            DisStats stats = {0};
+            dis_verify(roms.items[i], (const uint8_t*)data, size, base, start, &stats);
+            if (stats.mismatches > 0) {
+                printf("%s: %llu of %llu instructions don't reassemble\n", roms.items[i],
+                       (unsigned long long)stats.mismatches, (unsigned long long)stats.instructions);
+            }
+            total.words += stats.words;
+            total.instructions += stats.instructions;
+            total.data += stats.data;
+            total.mismatches += stats.mismatches;
+        } else {
+            if (roms.count > 1) {
+                dis_flush(&out);
+                printf("%s%s:\n", i > 0 ? "\n" : "", roms.items[i]);
+            }
+            dis_list(&out, (const uint8_t*)data, size, base, start);
+        }
+        util_unmap_file(data, size);
+    }
+    dis_flush(&out);
+
+    if (verify) {
+        printf("%zu roms, %llu words: %llu instructions (%llu mismatched), %llu data\n", roms.count - failed,
+               (unsigned long long)total.words, (unsigned long long)total.instructions,
+               (unsigned long long)total.mismatches, (unsigned long long)total.data);
+    }
+
+    util_da_free(&roms);
+    return failed > 0 || total.mismatches > 0 ? 1 : 0;
+}
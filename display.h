@@ -1,104 +1,170 @@
 #ifndef CHIP8_DISPLAY_H
 #define CHIP8_DISPLAY_H
 
-#include <ncurses.h>
 #include <stdio.h>
-
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined(CHIP8_SCHIP) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// CHIP8_SCHIP builds have the SUPER-CHIP 128x64 display, the plain build keeps
+// 64x32 and none of the code below for the bigger one
+#ifdef CHIP8_SCHIP
+#define DISPLAY_WIDTH 128
+#define DISPLAY_HEIGHT 64
+typedef unsigned __int128 DisplayRow;
+#else
 #define DISPLAY_WIDTH 64
 #define DISPLAY_HEIGHT 32
+typedef uint64_t DisplayRow;
+#endif
 
-uint8_t display[DISPLAY_WIDTH][DISPLAY_HEIGHT] = {0};
+_Static_assert(sizeof(DisplayRow) * 8 == DISPLAY_WIDTH, "display rows are packed into one DisplayRow");
 
-WINDOW* display_win;
-WINDOW* debug_win;
+// framebuffer with one word per row, the MSB is the leftmost pixel (x = 0)
+typedef DisplayRow Display[DISPLAY_HEIGHT];
 
-uint8_t display_draw_sprite(uint8_t x, uint8_t y, uint8_t n, uint8_t *memory) {
-    uint8_t collision = 0;
-    // display n-byte sprite starting at memory (offset from I) at coordinates (Vx, Vy), set VF = pixel collision
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < 8; j++) {
-            uint8_t* prev_pixel = &(display[(x + j) % DISPLAY_WIDTH][(y + i) % DISPLAY_HEIGHT]);
-            uint8_t new_pixel = (memory[i] >> (7 - j)) & 1;
+// XO-CHIP has two bitplanes, stored as two Displays back to back (plane p starts at row
+// p * DISPLAY_HEIGHT), so clearing and scrolling run the same row code on each plane and a
+// draw to both planes walks the two in one pass
+#ifdef CHIP8_XOCHIP
+#define DISPLAY_PLANES 2
+#else
+#define DISPLAY_PLANES 1
+#endif
 
-            if (!collision && (*prev_pixel) && new_pixel)
-                collision = 1;
+DisplayRow* display_plane(DisplayRow* display, int plane) {
+    return display + plane * DISPLAY_HEIGHT;
+}
 
-            (*prev_pixel) ^= new_pixel;
-        }
-    }
-    return collision;
+uint8_t display_pixel(const DisplayRow* display, int x, int y) {
+    return (display[y] >> (DISPLAY_WIDTH - 1 - x)) & 1;
 }
 
-void display_init() {
-    initscr();
-    noecho();
-    cbreak();
+// the 64 pixels of `row` starting at x = 64 * i
+uint64_t display_row_word(DisplayRow row, int i) {
+    return (uint64_t)(row >> (DISPLAY_WIDTH - 64 - 64 * i));
+}
 
-    display_win = newwin(DISPLAY_HEIGHT, DISPLAY_WIDTH, 0, 0);
-    debug_win = newwin(DISPLAY_HEIGHT, DISPLAY_WIDTH + 20, 0, DISPLAY_WIDTH + 1);
-    keypad(display_win, TRUE);
-    nodelay(display_win, TRUE);
-    wrefresh(display_win);
-    wrefresh(debug_win);
+DisplayRow display_rotr(DisplayRow row, uint8_t shift) {
+    return (row >> shift) | (row << (-shift & (DISPLAY_WIDTH - 1)));
+}
 
-    refresh();
+uint8_t display_draw_sprite(DisplayRow* display, uint8_t x, uint8_t y, uint8_t n, const uint8_t *memory) {
+    DisplayRow collision = 0;
+    // display n-byte sprite starting at memory (offset from I) at coordinates (Vx, Vy), set VF = pixel collision
+    //   each sprite byte is moved to the top of a row word and rotated into place, which also wraps it around
+    for (int i = 0; i < n; i++) {
+        DisplayRow* row = &display[(y + i) % DISPLAY_HEIGHT];
+        DisplayRow sprite = display_rotr((DisplayRow)memory[i] << (DISPLAY_WIDTH - 8), x % DISPLAY_WIDTH);
+
+        collision |= *row & sprite;
+        *row ^= sprite;
+    }
+    return collision != 0;
 }
 
-void display_end() {
-    endwin();
+#ifdef CHIP8_SCHIP
+// every bit of `byte` twice, low resolution pixels are 2x2 on the 128x64 display
+uint16_t display_double_bits(uint8_t byte) {
+    uint16_t bits = byte;
+    bits = (bits | bits << 4) & 0x0F0F;
+    bits = (bits | bits << 2) & 0x3333;
+    bits = (bits | bits << 1) & 0x5555;
+    return bits | bits << 1;
 }
 
-void display_refresh() {
-    wmove(display_win, 0, 0);
-    for (int i = 0; i < DISPLAY_HEIGHT; i++) {
-        for (int j = 0; j < DISPLAY_WIDTH; j++) {
-            if (display[j][i])
-                waddch(display_win, '0');
-            else
-                waddch(display_win, '.');
+// XOR `n` sprite rows of up to 32 pixels (MSB leftmost) at (x, y), each row `repeat` times,
+// returns 1 on collision
+uint8_t display_draw_rows(DisplayRow* display, int x, int y, const uint32_t* rows, int n, int repeat) {
+    DisplayRow collision = 0;
+    for (int i = 0; i < n; i++) {
+        DisplayRow sprite = display_rotr((DisplayRow)rows[i] << (DISPLAY_WIDTH - 32), x % DISPLAY_WIDTH);
+        for (int r = 0; r < repeat; r++) {
+            DisplayRow* row = &display[(y + i * repeat + r) % DISPLAY_HEIGHT];
+            collision |= *row & sprite;
+            *row ^= sprite;
         }
     }
-    wrefresh(display_win);
+    return collision != 0;
 }
 
-void display_clear() {
-    memset(display, 0, sizeof(display));
-    display_refresh();
+#ifdef CHIP8_XOCHIP
+// display_draw_rows for both planes at once: `rows` holds n rows for the first plane, then n
+// for the second, and each screen row XORs and tests the two planes in the same pass
+uint8_t display_draw_rows_both(DisplayRow* display, int x, int y, const uint32_t* rows, int n, int repeat) {
+    DisplayRow collision = 0;
+    for (int i = 0; i < n; i++) {
+        DisplayRow first = display_rotr((DisplayRow)rows[i] << (DISPLAY_WIDTH - 32), x % DISPLAY_WIDTH);
+        DisplayRow second = display_rotr((DisplayRow)rows[n + i] << (DISPLAY_WIDTH - 32), x % DISPLAY_WIDTH);
+        for (int r = 0; r < repeat; r++) {
+            DisplayRow* row = &display[(y + i * repeat + r) % DISPLAY_HEIGHT];
+            collision |= (row[0] & first) | (row[DISPLAY_HEIGHT] & second);
+            row[0] ^= first;
+            row[DISPLAY_HEIGHT] ^= second;
+        }
+    }
+    return collision != 0;
+}
+#endif
+
+// Scrolls move whole rows: up and down are a memmove of the rows, left and right
+// shift every row, two 64 bit lanes at a time with SSE2.
+void display_scroll_down(DisplayRow* display, int n) {
+    if (n > DISPLAY_HEIGHT) n = DISPLAY_HEIGHT;
+    memmove(display + n, display, (DISPLAY_HEIGHT - n) * sizeof(DisplayRow));
+    memset(display, 0, n * sizeof(DisplayRow));
 }
 
-void display_debug_info(uint16_t pc, uint8_t *V, uint16_t I, uint16_t sp, uint16_t *stack, uint8_t *memory, uint8_t delay_timer, uint8_t sound_timer) {
-    wmove(debug_win, 0, 0);
-
-    uint16_t opcode = memory[pc] << 8 | memory[pc + 1];
-    wprintw(debug_win, "Opcode: %04X\n", opcode);
-    wprintw(debug_win, "PC:     %04X\n", pc);
-    wprintw(debug_win, "I:      %04X\n", I);
-    wprintw(debug_win, "SP:     %04X\n", sp);
+void display_scroll_up(DisplayRow* display, int n) {
+    if (n > DISPLAY_HEIGHT) n = DISPLAY_HEIGHT;
+    memmove(display, display + n, (DISPLAY_HEIGHT - n) * sizeof(DisplayRow));
+    memset(display + DISPLAY_HEIGHT - n, 0, n * sizeof(DisplayRow));
+}
 
-    wprintw(debug_win, "\nRegisters:\n    ");
-    for (int i = 0; i < 16; i++) {
-        wprintw(debug_win, "V%X ", i);
+// shift every row `shift` (1..63) pixels to the left, or to the right when `right` is set
+void display_scroll_horizontal(DisplayRow* display, int shift, bool right) {
+#ifdef __SSE2__
+    // rows are little-endian, the high lane holds the left half of the row
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i carry_count = _mm_cvtsi32_si128(64 - shift);
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        __m128i row = _mm_loadu_si128((const __m128i*)&display[y]);
+        __m128i moved, carry;
+        if (right) {
+            moved = _mm_srl_epi64(row, count);
+            carry = _mm_sll_epi64(_mm_srli_si128(row, 8), carry_count); // high lane's low bits into the low lane
+        } else {
+            moved = _mm_sll_epi64(row, count);
+            carry = _mm_srl_epi64(_mm_slli_si128(row, 8), carry_count); // low lane's high bits into the high lane
+        }
+        _mm_storeu_si128((__m128i*)&display[y], _mm_or_si128(moved, carry));
     }
-    wprintw(debug_win, "\n    ");
-    for (int i = 0; i < 16; i++) {
-        wprintw(debug_win, "%02X ", V[i]);
+#else
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        display[y] = right ? display[y] >> shift : display[y] << shift;
     }
+#endif
+}
+#endif
 
-    wprintw(debug_win, "\n\nStack: \n    ");
-    for (int i = 0; i < 16; i++) {
-        wprintw(debug_win, "%04X ", stack[i]);
-    }
+void display_clear(DisplayRow* display) {
+    memset(display, 0, sizeof(Display));
+}
 
-    wprintw(debug_win, "\nMemory (+I) [%04X-%04X]:\n    ", I, I + 16);
-    for (int i = 0; i < 16; i++) {
-        wprintw(debug_win, "%02X ", memory[i + I]);
+// write the framebuffer as text, using the same glyphs as the terminal
+void display_print(const DisplayRow* display, FILE* out) {
+    char row[DISPLAY_WIDTH + 1];
+    row[DISPLAY_WIDTH] = '\n';
+    for (int i = 0; i < DISPLAY_HEIGHT; i++) {
+        for (int j = 0; j < DISPLAY_WIDTH; j++) {
+            row[j] = display_pixel(display, j, i) ? '0' : '.';
+        }
+        fwrite(row, 1, sizeof(row), out);
     }
-    wprintw(debug_win, "...\n");
-
-    wprintw(debug_win, "\nDelay Timer: %02X\n", delay_timer);
-    wprintw(debug_win, "Sound Timer: %02X\n", sound_timer);
-
-    wrefresh(debug_win);
 }
 
 #endif // CHIP8_DISPLAY_H
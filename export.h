@@ -0,0 +1,188 @@
+#ifndef CHIP8_EXPORT_H
+#define CHIP8_EXPORT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "chip8.h"
+
+// Headless frame export, for regression artifacts and videos.
+//
+// Frames are rendered as 1 bit per pixel, MSB first, scaled up by an integer
+// factor: a lookup table turns every display byte (8 pixels) into `scale`
+// output bytes, and each output row is then repeated `scale` times. Frames are
+// rendered straight into the output buffer, which is written out with write()
+// when it fills up (or once per file for image sequences).
+//
+//   EXPORT_PBM   one binary PBM (P4, the 1 bit netpbm/PPM format) per frame that
+//                changed the display, named PREFIX<frame>.pbm
+//   EXPORT_RAW   every frame into one file, back to back without headers
+//   EXPORT_PIPE  the raw stream into a command's stdin, for example
+//                ffmpeg -f rawvideo -pix_fmt monob -s 64x32 -r 60 -i - out.mp4
+//
+// The raw stream has lit pixels as 1 (ffmpeg's monob), PBM has them as 0 since
+// 1 is black there.
+
+#define EXPORT_MAX_SCALE 16
+#define EXPORT_BUFFER_SIZE (1024 * 1024) // raw frames are batched up to this many bytes per write()
+#define EXPORT_HEADER_SIZE 32            // room for the PBM header in front of the frame
+
+typedef enum {
+    EXPORT_NONE = 0,
+    EXPORT_PBM,
+    EXPORT_RAW,
+    EXPORT_PIPE,
+} ExportTarget;
+
+typedef struct {
+    ExportTarget target;
+    const char* path;         // file name prefix, output file or command
+    uint8_t scale;
+    int fd;                   // EXPORT_RAW and EXPORT_PIPE
+    FILE* pipe;
+
+    uint8_t lut[256][EXPORT_MAX_SCALE]; // display byte -> `scale` output bytes
+    uint8_t* items;
+    size_t count;
+    size_t capacity;
+
+    uint64_t frames;          // vm->clock.frames when the last frame was exported
+    uint64_t presented;       // vm->presented likewise, for EXPORT_PBM
+    uint64_t frames_written;
+    uint64_t bytes_written;
+    bool failed;              // a write failed, nothing more is exported
+} Export;
+
+// bytes of one rendered frame
+size_t export_frame_size(const Export* export) {
+    return (size_t)DISPLAY_WIDTH / 8 * export->scale * DISPLAY_HEIGHT * export->scale;
+}
+
+bool export_write_all(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+bool export_flush(Export* export) {
+    if (export->count == 0 || export->failed) return !export->failed;
+    if (!export_write_all(export->fd, export->items, export->count)) export->failed = true;
+    export->bytes_written += export->count;
+    export->count = 0;
+    return !export->failed;
+}
+
+bool export_open(Export* export, ExportTarget target, const char* path, uint8_t scale) {
+    memset(export, 0, sizeof(*export));
+    if (scale == 0 || scale > EXPORT_MAX_SCALE) return false;
+    export->target = target;
+    export->path = path;
+    export->scale = scale;
+    export->fd = -1;
+
+    // each bit of the display byte becomes `scale` bits of output
+    for (int byte = 0; byte < 256; byte++) {
+        for (int bit = 0; bit < 8 * scale; bit++) {
+            if ((byte >> (7 - bit / scale)) & 1) export->lut[byte][bit / 8] |= 0x80 >> (bit % 8);
+        }
+        if (target == EXPORT_PBM) {
+            for (int i = 0; i < scale; i++) export->lut[byte][i] = ~export->lut[byte][i];
+        }
+    }
+
+    export->capacity = EXPORT_HEADER_SIZE + export_frame_size(export);
+    if (target != EXPORT_PBM && export->capacity < EXPORT_BUFFER_SIZE) export->capacity = EXPORT_BUFFER_SIZE;
+    export->items = malloc(export->capacity + EXPORT_MAX_SCALE); // export_render() copies whole lut entries
+    if (export->items == NULL) return false;
+
+    if (target == EXPORT_RAW) {
+        export->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (export->fd < 0) return false;
+    } else if (target == EXPORT_PIPE) {
+        signal(SIGPIPE, SIG_IGN); // a command that quits early shows up as a failed write instead
+        export->pipe = popen(path, "w");
+        if (export->pipe == NULL) return false;
+        export->fd = fileno(export->pipe);
+    }
+    return true;
+}
+
+// render the front buffer into the output buffer at `out`
+void export_render(const Export* export, const DisplayRow* display, uint8_t* out) {
+    size_t row_size = DISPLAY_WIDTH / 8 * export->scale;
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        uint8_t* row = out;
+        for (int i = 0; i < DISPLAY_WIDTH / 8; i++) {
+            uint8_t byte = display[y] >> (DISPLAY_WIDTH - 8 - 8 * i);
+            memcpy(out, export->lut[byte], EXPORT_MAX_SCALE); // fixed size copy, the next one overwrites the tail
+            out += export->scale;
+        }
+        for (int i = 1; i < export->scale; i++) {
+            memcpy(out, row, row_size);
+            out += row_size;
+        }
+    }
+}
+
+bool export_write_pbm(Export* export, const Chip8* vm) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%06llu.pbm", export->path, (unsigned long long)vm->clock.frames);
+    int header = snprintf((char*)export->items, EXPORT_HEADER_SIZE, "P4\n%d %d\n",
+                          DISPLAY_WIDTH * export->scale, DISPLAY_HEIGHT * export->scale);
+    export_render(export, vm->frame, export->items + header);
+    size_t length = header + export_frame_size(export);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = export_write_all(fd, export->items, length);
+    close(fd);
+    export->bytes_written += length;
+    return ok;
+}
+
+// export the frame that just ended, call after every chip8_run_frame()
+bool export_frame(Export* export, const Chip8* vm) {
+    if (export->failed || vm->clock.frames == export->frames) return !export->failed; // still mid-frame
+    export->frames = vm->clock.frames;
+
+    if (export->target == EXPORT_PBM) {
+        if (vm->presented == export->presented) return true; // same picture as the last file
+        export->presented = vm->presented;
+        if (!export_write_pbm(export, vm)) export->failed = true;
+    } else {
+        size_t size = export_frame_size(export);
+        if (export->count + size > export->capacity && !export_flush(export)) return false;
+        export_render(export, vm->frame, export->items + export->count);
+        export->count += size;
+    }
+    export->frames_written++;
+    return !export->failed;
+}
+
+// flush and close, false if anything couldn't be written
+bool export_close(Export* export) {
+    bool ok = export_flush(export);
+    if (export->pipe != NULL) {
+        if (pclose(export->pipe) != 0) ok = false;
+    } else if (export->fd >= 0) {
+        close(export->fd);
+    }
+    free(export->items);
+    export->items = NULL;
+    return ok && !export->failed;
+}
+
+#endif // CHIP8_EXPORT_H
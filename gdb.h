@@ -0,0 +1,501 @@
+#ifndef CHIP8_GDB_H
+#define CHIP8_GDB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "chip8.h"
+#include "debug.h"
+
+// GDB remote serial protocol stub, so gdb (or lldb, or a script) can attach to a running chip8.
+//
+// The stub listens on a localhost TCP port or a Unix socket and serves one
+// client at a time. Everything goes through the debugger in debug.h: `c` and
+// `s` set its mode, Z0/z0 add and remove its breakpoints, and when it stops
+// the stop reply is sent. gdb_poll() is called once per frame, so between
+// stops the machine runs its frames as usual (at full speed while no
+// breakpoint is set) and only looks at the socket for ^C in between. While
+// the target is stopped, gdb_poll() keeps answering packets for up to a
+// frame, so a burst of memory reads doesn't take a frame per packet.
+//
+// Registers, in `g` order and little-endian:
+//   0-15  V0-VF  8 bit
+//   16    I      16 bit
+//   17    pc     16 bit
+//   18    sp     8 bit
+//   19    dt     8 bit
+//   20    st     8 bit
+// target.xml describes the same layout.
+
+#define GDB_PACKET_SIZE 4096
+#define GDB_REGISTER_COUNT 21
+#define GDB_WAIT_MS 16 // how long a stopped target waits for the next packet within a frame
+
+#define GDB_REG_I  16
+#define GDB_REG_PC 17
+#define GDB_REG_SP 18
+#define GDB_REG_DT 19
+#define GDB_REG_ST 20
+
+#define GDB_SIGINT 2
+#define GDB_SIGILL 4
+#define GDB_SIGTRAP 5
+
+typedef struct {
+    int listen_fd;
+    int fd;                     // the client, -1 while nobody is attached
+    const char* unix_path;      // removed again by gdb_close()
+    bool no_ack;                // QStartNoAckMode, no more +/- after packets
+    bool running;               // a c or s is waiting for its stop reply
+    int signal;                 // of the last stop, for `?`
+
+    char in[GDB_PACKET_SIZE * 2];
+    size_t in_count;
+    char reply[GDB_PACKET_SIZE * 2 + 8];
+    char target_xml[2048];
+} GdbStub;
+
+// bytes of register n
+int gdb_register_size(int n) {
+    return n == GDB_REG_I || n == GDB_REG_PC ? 2 : 1;
+}
+
+uint16_t gdb_register(const Chip8* vm, int n) {
+    if (n < 16) return vm->registers[n];
+    switch (n) {
+        case GDB_REG_I:  return vm->I;
+        case GDB_REG_PC: return vm->pc;
+        case GDB_REG_SP: return vm->sp;
+        case GDB_REG_DT: return vm->delay_timer;
+        case GDB_REG_ST: return vm->sound_timer;
+    }
+    return 0;
+}
+
+void gdb_set_register(Chip8* vm, int n, uint16_t value) {
+    if (n < 16) { vm->registers[n] = value; return; }
+    switch (n) {
+        case GDB_REG_I:  vm->I = value; break;
+        case GDB_REG_PC: vm->pc = value & CHIP8_ADDRESS_MASK; break;
+        case GDB_REG_SP: vm->sp = value & 0xF; break;
+        case GDB_REG_DT: vm->delay_timer = value; break;
+        case GDB_REG_ST: vm->sound_timer = value; break;
+    }
+}
+
+void gdb_build_target_xml(GdbStub* gdb) {
+    static const char* names[GDB_REGISTER_COUNT - 16] = { "i", "pc", "sp", "dt", "st" };
+    static const char* types[GDB_REGISTER_COUNT - 16] = { "data_ptr", "code_ptr", "uint8", "uint8", "uint8" };
+    char* out = gdb->target_xml;
+    char* end = out + sizeof(gdb->target_xml);
+    out += snprintf(out, end - out, "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+                                    "<target version=\"1.0\"><feature name=\"org.chip8.core\">");
+    for (int n = 0; n < GDB_REGISTER_COUNT; n++) {
+        if (n < 16) out += snprintf(out, end - out, "<reg name=\"v%x\" bitsize=\"8\" type=\"uint8\"/>", n);
+        else out += snprintf(out, end - out, "<reg name=\"%s\" bitsize=\"%d\" type=\"%s\"/>", names[n - 16],
+                             8 * gdb_register_size(n), types[n - 16]);
+    }
+    snprintf(out, end - out, "</feature></target>");
+}
+
+bool gdb_open_failed(GdbStub* gdb) {
+    if (gdb->listen_fd >= 0) close(gdb->listen_fd);
+    gdb->listen_fd = -1;
+    gdb->unix_path = NULL;
+    return false;
+}
+
+// listen on `spec`, a TCP port on 127.0.0.1 when it's a number and a Unix socket path otherwise
+bool gdb_open(GdbStub* gdb, const char* spec) {
+    memset(gdb, 0, sizeof(*gdb));
+    gdb->listen_fd = -1;
+    gdb->fd = -1;
+    gdb->signal = GDB_SIGTRAP;
+    gdb_build_target_xml(gdb);
+
+    char* end;
+    unsigned long port = strtoul(spec, &end, 10);
+    if (end != spec && *end == '\0') {
+        if (port == 0 || port > 0xFFFF) return false;
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+        gdb->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (gdb->listen_fd < 0) return false;
+        int on = 1;
+        setsockopt(gdb->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(gdb->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) return gdb_open_failed(gdb);
+    } else {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(spec) >= sizeof(addr.sun_path)) return false;
+        strcpy(addr.sun_path, spec);
+        struct stat st;
+        if (stat(spec, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(spec); // left behind by an earlier run
+        gdb->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (gdb->listen_fd < 0) return false;
+        if (bind(gdb->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) return gdb_open_failed(gdb);
+        gdb->unix_path = spec;
+    }
+    if (listen(gdb->listen_fd, 1) < 0) {
+        if (gdb->unix_path != NULL) unlink(gdb->unix_path);
+        return gdb_open_failed(gdb);
+    }
+    fcntl(gdb->listen_fd, F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+void gdb_disconnect(GdbStub* gdb) {
+    if (gdb->fd >= 0) close(gdb->fd);
+    gdb->fd = -1;
+    gdb->in_count = 0;
+    gdb->no_ack = false;
+    gdb->running = false;
+}
+
+void gdb_close(GdbStub* gdb) {
+    gdb_disconnect(gdb);
+    if (gdb->listen_fd >= 0) close(gdb->listen_fd);
+    if (gdb->unix_path != NULL) unlink(gdb->unix_path);
+}
+
+void gdb_write(GdbStub* gdb, const char* data, size_t length) {
+    while (length > 0 && gdb->fd >= 0) {
+        ssize_t written = send(gdb->fd, data, length, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            gdb_disconnect(gdb);
+            return;
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+// send `data` as one packet, escaping the characters the framing uses
+void gdb_send(GdbStub* gdb, const char* data, size_t length) {
+    char* out = gdb->reply;
+    uint8_t checksum = 0;
+    *out++ = '$';
+    for (size_t i = 0; i < length && out < gdb->reply + sizeof(gdb->reply) - 6; i++) {
+        char c = data[i];
+        if (c == '$' || c == '#' || c == '}' || c == '*') {
+            *out++ = '}';
+            checksum += '}';
+            c ^= 0x20;
+        }
+        *out++ = c;
+        checksum += (uint8_t)c;
+    }
+    out += sprintf(out, "#%02x", checksum);
+    gdb_write(gdb, gdb->reply, out - gdb->reply);
+}
+
+void gdb_send_text(GdbStub* gdb, const char* text) {
+    gdb_send(gdb, text, strlen(text));
+}
+
+// parse hex digits from *text on, advancing it past them
+uint32_t gdb_parse_hex(const char** text) {
+    uint32_t value = 0;
+    while (char_to_hex_val(**text) >= 0) value = value << 4 | char_to_hex_val(*(*text)++);
+    return value;
+}
+
+void gdb_put_hex(char* out, uint16_t value, int size) {
+    for (int i = 0; i < size; i++) sprintf(out + 2 * i, "%02x", (value >> (8 * i)) & 0xFF);
+}
+
+uint16_t gdb_get_hex(const char* text, int size) {
+    uint16_t value = 0;
+    for (int i = 0; i < size; i++) value |= (char_to_hex_val(text[2 * i]) << 4 | char_to_hex_val(text[2 * i + 1])) << (8 * i);
+    return value;
+}
+
+// the stop reply for the last stop, also the answer to `?`
+void gdb_send_signal(GdbStub* gdb, const Chip8* vm) {
+    char text[8];
+    if (vm->status == CHIP8_EXITED) snprintf(text, sizeof(text), "W00");
+    else snprintf(text, sizeof(text), "S%02x", gdb->signal);
+    gdb_send_text(gdb, text);
+}
+
+// the stop reply for why the debugger just paused
+void gdb_send_stop(GdbStub* gdb, const Debugger* dbg, const Chip8* vm) {
+    switch (dbg->stop) {
+        case DEBUG_STOP_NONE:    gdb->signal = GDB_SIGINT; break; // ^C or paused at the keyboard
+        case DEBUG_STOP_HALTED:  gdb->signal = GDB_SIGILL; break;
+        default:                 gdb->signal = GDB_SIGTRAP; break;
+    }
+    gdb_send_signal(gdb, vm); // a plain trap for the command line watchpoints too, gdb didn't set them
+}
+
+// stop and tell the client, for ^C and a new connection
+void gdb_pause(GdbStub* gdb, Debugger* dbg, const Chip8* vm) {
+    debug_set_mode(dbg, vm, DEBUG_PAUSED);
+    dbg->stop = DEBUG_STOP_NONE;
+    gdb->running = false;
+}
+
+// memory read `m addr,length` and write `M addr,length:data`
+void gdb_memory(GdbStub* gdb, Chip8* vm, const char* args, bool write) {
+    uint32_t addr = gdb_parse_hex(&args);
+    if (*args++ != ',') { gdb_send_text(gdb, "E01"); return; }
+    uint32_t length = gdb_parse_hex(&args);
+    if (addr >= CHIP8_MEMORY_SIZE || length > GDB_PACKET_SIZE / 2 || addr + length > CHIP8_MEMORY_SIZE) {
+        // reads stop at the end of memory, writes past it fail
+        if (write || addr >= CHIP8_MEMORY_SIZE || length > GDB_PACKET_SIZE / 2) { gdb_send_text(gdb, "E01"); return; }
+        length = CHIP8_MEMORY_SIZE - addr;
+    }
+
+    if (write) {
+        if (*args++ != ':' || strlen(args) < 2 * length) { gdb_send_text(gdb, "E01"); return; }
+        for (uint32_t i = 0; i < length; i++) vm->memory[addr + i] = gdb_get_hex(args + 2 * i, 1);
+        chip8_memory_written(vm, addr, length);
+        gdb_send_text(gdb, "OK");
+        return;
+    }
+    char hex[GDB_PACKET_SIZE + 1];
+    for (uint32_t i = 0; i < length; i++) gdb_put_hex(hex + 2 * i, vm->memory[addr + i], 1);
+    gdb_send(gdb, hex, 2 * length);
+}
+
+// qXfer:features:read:target.xml:offset,length
+void gdb_features(GdbStub* gdb, const char* args) {
+    const char* annex = "target.xml:";
+    if (strncmp(args, annex, strlen(annex)) != 0) { gdb_send_text(gdb, "E00"); return; }
+    args += strlen(annex);
+    uint32_t offset = gdb_parse_hex(&args);
+    if (*args++ != ',') { gdb_send_text(gdb, "E00"); return; }
+    uint32_t length = gdb_parse_hex(&args);
+
+    size_t size = strlen(gdb->target_xml);
+    if (offset > size) offset = size;
+    if (length > size - offset) length = size - offset;
+    if (length > GDB_PACKET_SIZE - 1) length = GDB_PACKET_SIZE - 1;
+    char chunk[GDB_PACKET_SIZE];
+    chunk[0] = offset + length < size ? 'm' : 'l';
+    memcpy(chunk + 1, gdb->target_xml + offset, length);
+    gdb_send(gdb, chunk, length + 1);
+}
+
+// answer one packet, false when the client asked to kill the emulator
+bool gdb_handle(GdbStub* gdb, Debugger* dbg, Chip8* vm, char* packet) {
+    char* args = packet + 1;
+    char text[128];
+
+    switch (packet[0]) {
+        case '?':
+            gdb_send_signal(gdb, vm);
+            return true;
+
+        case 'g': {
+            char* out = text;
+            for (int n = 0; n < GDB_REGISTER_COUNT; n++) {
+                gdb_put_hex(out, gdb_register(vm, n), gdb_register_size(n));
+                out += 2 * gdb_register_size(n);
+            }
+            gdb_send(gdb, text, out - text);
+            return true;
+        }
+
+        case 'G': {
+            const char* in = args;
+            for (int n = 0; n < GDB_REGISTER_COUNT; n++) {
+                int size = gdb_register_size(n);
+                if (strlen(in) < 2u * size) break;
+                gdb_set_register(vm, n, gdb_get_hex(in, size));
+                in += 2 * size;
+            }
+            gdb_send_text(gdb, "OK");
+            return true;
+        }
+
+        case 'p': case 'P': {
+            const char* in = args;
+            uint32_t n = gdb_parse_hex(&in);
+            if (n >= GDB_REGISTER_COUNT || (packet[0] == 'P' && *in++ != '=')) {
+                gdb_send_text(gdb, "E01");
+                return true;
+            }
+            int size = gdb_register_size(n);
+            if (packet[0] == 'P') {
+                if (strlen(in) < 2u * size) {
+                    gdb_send_text(gdb, "E01");
+                    return true;
+                }
+                gdb_set_register(vm, n, gdb_get_hex(in, size));
+                gdb_send_text(gdb, "OK");
+            } else {
+                gdb_put_hex(text, gdb_register(vm, n), size);
+                gdb_send(gdb, text, 2 * size);
+            }
+            return true;
+        }
+
+        case 'm': gdb_memory(gdb, vm, args, false); return true;
+        case 'M': gdb_memory(gdb, vm, args, true); return true;
+
+        case 'c': case 's': {
+            const char* in = args;
+            if (char_to_hex_val(*in) >= 0) vm->pc = gdb_parse_hex(&in) & CHIP8_ADDRESS_MASK;
+            debug_set_mode(dbg, vm, packet[0] == 'c' ? DEBUG_CONTINUE : DEBUG_STEP);
+            gdb->running = true;
+            return true; // the stop reply comes from gdb_report_stop()
+        }
+
+        case 'Z': case 'z': {
+            // software and hardware breakpoints are the same thing here, watchpoints aren't supported
+            const char* in = args;
+            uint32_t type = gdb_parse_hex(&in);
+            if (type > 1 || *in++ != ',') {
+                gdb_send_text(gdb, "");
+                return true;
+            }
+            uint32_t addr = gdb_parse_hex(&in);
+            bool ok = addr < CHIP8_MEMORY_SIZE;
+            if (ok && packet[0] == 'z') debug_remove_breakpoint(dbg, addr);
+            else if (ok) ok = debug_add_breakpoint(dbg, addr, NULL);
+            gdb_send_text(gdb, ok ? "OK" : "E01");
+            return true;
+        }
+
+        case 'D':
+            gdb_send_text(gdb, "OK");
+            gdb_disconnect(gdb);
+            debug_set_mode(dbg, vm, DEBUG_CONTINUE);
+            return true;
+
+        case 'k':
+            gdb_disconnect(gdb);
+            return false;
+
+        case 'H':
+            gdb_send_text(gdb, "OK"); // there is only one thread
+            return true;
+
+        case 'q':
+            if (strncmp(args, "Supported", 9) == 0) {
+                snprintf(text, sizeof(text), "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", GDB_PACKET_SIZE);
+                gdb_send_text(gdb, text);
+            } else if (strncmp(args, "Xfer:features:read:", 19) == 0) {
+                gdb_features(gdb, args + 19);
+            } else if (strcmp(args, "Attached") == 0) {
+                gdb_send_text(gdb, "1");
+            } else if (strcmp(args, "C") == 0) {
+                gdb_send_text(gdb, "QC1");
+            } else if (strcmp(args, "fThreadInfo") == 0) {
+                gdb_send_text(gdb, "m1");
+            } else if (strcmp(args, "sThreadInfo") == 0) {
+                gdb_send_text(gdb, "l");
+            } else {
+                gdb_send_text(gdb, "");
+            }
+            return true;
+
+        case 'Q':
+            if (strcmp(args, "StartNoAckMode") == 0) {
+                gdb_send_text(gdb, "OK");
+                gdb->no_ack = true;
+            } else {
+                gdb_send_text(gdb, "");
+            }
+            return true;
+
+        default:
+            gdb_send_text(gdb, ""); // not supported
+            return true;
+    }
+}
+
+// take the complete packets out of the input buffer and answer them, false on kill
+bool gdb_process(GdbStub* gdb, Debugger* dbg, Chip8* vm) {
+    if (gdb->running) {
+        // only ^C counts until the stop reply is out, packets wait in the buffer until then
+        char* interrupt = memchr(gdb->in, '\x03', gdb->in_count);
+        if (interrupt == NULL) return true;
+        memmove(interrupt, interrupt + 1, gdb->in + gdb->in_count - interrupt - 1);
+        gdb->in_count--;
+        gdb_pause(gdb, dbg, vm);
+        gdb_send_stop(gdb, dbg, vm);
+    }
+
+    size_t i = 0;
+    while (i < gdb->in_count && gdb->fd >= 0 && !gdb->running) {
+        char c = gdb->in[i];
+        if (c != '$') { // acks, noise and a ^C while stopped
+            i++;
+            continue;
+        }
+
+        char* hash = memchr(gdb->in + i, '#', gdb->in_count - i);
+        if (hash == NULL || hash + 2 >= gdb->in + gdb->in_count) break; // the rest hasn't arrived yet
+
+        char* packet = gdb->in + i + 1;
+        *hash = '\0';
+        uint8_t checksum = 0;
+        for (char* p = packet; p < hash; p++) checksum += (uint8_t)*p;
+        bool valid = char_to_hex_val(hash[1]) >= 0 && char_to_hex_val(hash[2]) >= 0 &&
+                     (char_to_hex_val(hash[1]) << 4 | char_to_hex_val(hash[2])) == checksum;
+        i = hash + 3 - gdb->in;
+
+        if (!gdb->no_ack) gdb_write(gdb, valid ? "+" : "-", 1);
+        if (valid && !gdb_handle(gdb, dbg, vm, packet)) return false;
+    }
+    if (gdb->fd < 0) return true;
+
+    memmove(gdb->in, gdb->in + i, gdb->in_count - i);
+    gdb->in_count -= i;
+    if (gdb->in_count == sizeof(gdb->in)) gdb->in_count = 0; // a packet that can never fit
+    return true;
+}
+
+// accept a client, read what it sent and answer it. While the target is stopped this keeps
+// serving packets for up to GDB_WAIT_MS. Returns false when the client killed the emulator.
+bool gdb_poll(GdbStub* gdb, Debugger* dbg, Chip8* vm) {
+    if (gdb->fd < 0) {
+        gdb->fd = accept(gdb->listen_fd, NULL, NULL);
+        if (gdb->fd < 0) return true;
+        gdb_pause(gdb, dbg, vm); // a target is stopped when gdb attaches
+        gdb->signal = GDB_SIGTRAP;
+    }
+    if (gdb->in_count > 0 && !gdb->running && !gdb_process(gdb, dbg, vm)) return false; // sent during the last c
+
+    int wait_ms = 0;
+    while (gdb->fd >= 0) {
+        struct pollfd in = { .fd = gdb->fd, .events = POLLIN };
+        if (poll(&in, 1, wait_ms) <= 0) break;
+
+        ssize_t length = recv(gdb->fd, gdb->in + gdb->in_count, sizeof(gdb->in) - gdb->in_count, MSG_DONTWAIT);
+        if (length < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (length <= 0) { // the client went away, let the machine run on
+            gdb_disconnect(gdb);
+            debug_set_mode(dbg, vm, DEBUG_CONTINUE);
+            break;
+        }
+        gdb->in_count += length;
+        if (!gdb_process(gdb, dbg, vm)) return false;
+        wait_ms = gdb->running ? 0 : GDB_WAIT_MS;
+    }
+    return true;
+}
+
+// send the stop reply once a c or s has stopped, call after running the frame
+void gdb_report_stop(GdbStub* gdb, Debugger* dbg, const Chip8* vm) {
+    if (gdb->fd < 0 || !gdb->running) return;
+    // a halted machine doesn't stop a continue that runs whole frames through chip8_run_frame()
+    if (vm->status == CHIP8_FAULT || vm->status == CHIP8_EXITED) debug_stop(dbg, DEBUG_STOP_HALTED, vm->pc);
+    if (dbg->mode != DEBUG_PAUSED) return;
+    gdb->running = false;
+    gdb_send_stop(gdb, dbg, vm);
+}
+
+#endif // CHIP8_GDB_H
@@ -0,0 +1,437 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+#include "command.h"
+
+#if !defined(__x86_64__)
+#error "jit.h only emits x86-64 code"
+#endif
+
+// Basic-block dynamic recompiler.
+//
+// A block starts at any pc and runs until the first instruction that changes
+// control flow (jmp, call, ret, jmp0, skips) or writes memory (mov B, mov [I]),
+// so every instruction inside a block runs exactly once per block execution.
+// Register-only opcodes are emitted as native code, everything else calls back
+// into the interpreter for that single instruction (display, keys, timers, rnd).
+//
+// Blocks are chained: a block ends by looking up the block at the new pc and
+// jumping straight into it, and only returns to C when that block hasn't been
+// translated yet or doesn't fit in the remaining instruction budget.
+//
+// Host register mapping while inside translated code:
+//   rbx -> registers (V0-VF are addressed as [rbx + x])
+//   r12 -> I
+//   r13 -> pc          (only written when leaving a block or calling back)
+//   r14 -> entry table (translated code per pc, NULL if not translated)
+//   r15 -> remaining instruction budget
+// pc itself is a translation-time constant for every instruction in a block.
+
+#define JIT_MEMORY_SIZE 4096
+#define JIT_CODE_SIZE (1 << 20)       // executable bytes shared by all blocks
+#define JIT_MAX_BLOCK_LENGTH 64       // instructions before a block is cut
+#define JIT_MAX_INSTRUCTION_BYTES 48  // worst case emitted bytes for one instruction
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_LENGTH * JIT_MAX_INSTRUCTION_BYTES + 64)
+
+// enter translated code at `code` with `budget` instructions, returns the budget left
+typedef uint64_t (*JitEnterFn)(uint8_t* code, uint64_t budget);
+
+typedef struct {
+    // machine state the emitted code works on
+    uint8_t* memory;
+    uint8_t* registers;
+    uint16_t* I;
+    uint16_t* pc;
+    void (*interpret)(void* context); // executes the single instruction at *pc
+    void* context;                    // passed through to interpret
+
+    uint8_t* code;
+    size_t code_used;
+    JitEnterFn enter;     // trampoline at the start of code
+    uint8_t* exit;        // trampoline tail, returns to C
+    uint8_t* dispatch;    // jumps to the block at *pc (or exits)
+    size_t code_start;    // first byte after the trampoline
+
+    uint8_t* entry[JIT_MEMORY_SIZE];     // translated block per start pc
+    uint16_t length[JIT_MEMORY_SIZE];    // instructions in each block
+    uint8_t translated[JIT_MEMORY_SIZE]; // 1 for every memory byte read into a block
+
+    uint64_t blocks_translated;
+    uint64_t flushes;
+} Jit;
+
+void jit_emit8(uint8_t** p, uint8_t byte) {
+    *(*p)++ = byte;
+}
+
+void jit_emit16(uint8_t** p, uint16_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+void jit_emit32(uint8_t** p, uint32_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+void jit_emit64(uint8_t** p, uint64_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+// 32-bit displacement from the end of a 4-byte operand at *p to target
+void jit_emit_rel32(uint8_t** p, uint8_t* target) {
+    jit_emit32(p, (uint32_t)(target - (*p + 4)));
+}
+
+// <op> [rbx + x], <reg>  /  <op> <reg>, [rbx + x]  (reg: 0 = al, 1 = cl)
+void jit_emit_vx(uint8_t** p, uint8_t op, uint8_t reg, uint8_t x) {
+    jit_emit8(p, op);
+    jit_emit8(p, 0x43 | (reg << 3));
+    jit_emit8(p, x);
+}
+
+// mov word [r13], pc
+void jit_emit_set_pc(uint8_t** p, uint16_t pc) {
+    jit_emit8(p, 0x66); jit_emit8(p, 0x41); jit_emit8(p, 0xC7); jit_emit8(p, 0x45); jit_emit8(p, 0x00);
+    jit_emit16(p, pc);
+}
+
+// pc = pc; interpret(context)
+void jit_emit_callback(Jit* jit, uint8_t** p, uint16_t pc) {
+    jit_emit_set_pc(p, pc);
+    jit_emit8(p, 0x48); jit_emit8(p, 0xBF); jit_emit64(p, (uint64_t)jit->context);   // mov rdi, context
+    jit_emit8(p, 0x48); jit_emit8(p, 0xB8); jit_emit64(p, (uint64_t)jit->interpret); // mov rax, interpret
+    jit_emit8(p, 0xFF); jit_emit8(p, 0xD0);                                           // call rax
+}
+
+// continue with whatever block *pc points at
+void jit_emit_dispatch(Jit* jit, uint8_t** p) {
+    jit_emit8(p, 0xE9); jit_emit_rel32(p, jit->dispatch); // jmp dispatch
+}
+
+// pc = (condition) ? pc + 4 : pc + 2, where the flags are already set and
+// `jcc_no_skip` is the short jump opcode taken when the skip does NOT happen
+void jit_emit_skip(uint8_t** p, uint16_t pc, uint8_t jcc_no_skip) {
+    jit_emit_set_pc(p, pc + 2);  // mov doesn't touch flags
+    jit_emit8(p, jcc_no_skip);
+    jit_emit8(p, 7);             // size of the set_pc below
+    jit_emit_set_pc(p, pc + 4);
+}
+
+// the C <-> translated code boundary, emitted once at the start of the code buffer
+void jit_emit_trampoline(Jit* jit) {
+    uint8_t* p = jit->code;
+
+    // enter(code = rdi, budget = rsi)
+    jit->enter = (JitEnterFn)p;
+    jit_emit8(&p, 0x53);                                         // push rbx
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x54);                    // push r12
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x55);                    // push r13
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x56);                    // push r14
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x57);                    // push r15 (stack is now 16-byte aligned for calls)
+    jit_emit8(&p, 0x48); jit_emit8(&p, 0xBB); jit_emit64(&p, (uint64_t)jit->registers); // mov rbx, registers
+    jit_emit8(&p, 0x49); jit_emit8(&p, 0xBC); jit_emit64(&p, (uint64_t)jit->I);         // mov r12, &I
+    jit_emit8(&p, 0x49); jit_emit8(&p, 0xBD); jit_emit64(&p, (uint64_t)jit->pc);        // mov r13, &pc
+    jit_emit8(&p, 0x49); jit_emit8(&p, 0xBE); jit_emit64(&p, (uint64_t)jit->entry);     // mov r14, entry
+    jit_emit8(&p, 0x49); jit_emit8(&p, 0x89); jit_emit8(&p, 0xF7);                      // mov r15, rsi
+    jit_emit8(&p, 0xFF); jit_emit8(&p, 0xE7);                                           // jmp rdi
+
+    // exit: return the remaining budget
+    jit->exit = p;
+    jit_emit8(&p, 0x4C); jit_emit8(&p, 0x89); jit_emit8(&p, 0xF8); // mov rax, r15
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x5F);                      // pop r15
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x5E);                      // pop r14
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x5D);                      // pop r13
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x5C);                      // pop r12
+    jit_emit8(&p, 0x5B);                                           // pop rbx
+    jit_emit8(&p, 0xC3);                                           // ret
+
+    // dispatch: jump to entry[pc] if it exists
+    jit->dispatch = p;
+    jit_emit8(&p, 0x41); jit_emit8(&p, 0x0F); jit_emit8(&p, 0xB7); jit_emit8(&p, 0x45); jit_emit8(&p, 0x00); // movzx eax, word [r13]
+    jit_emit8(&p, 0x3D); jit_emit32(&p, JIT_MEMORY_SIZE - 2);                          // cmp eax, last pc
+    jit_emit8(&p, 0x0F); jit_emit8(&p, 0x87); jit_emit_rel32(&p, jit->exit);           // ja exit
+    jit_emit8(&p, 0x49); jit_emit8(&p, 0x8B); jit_emit8(&p, 0x04); jit_emit8(&p, 0xC6); // mov rax, [r14 + rax*8]
+    jit_emit8(&p, 0x48); jit_emit8(&p, 0x85); jit_emit8(&p, 0xC0);                      // test rax, rax
+    jit_emit8(&p, 0x0F); jit_emit8(&p, 0x84); jit_emit_rel32(&p, jit->exit);           // jz exit
+    jit_emit8(&p, 0xFF); jit_emit8(&p, 0xE0);                                           // jmp rax
+
+    jit->code_start = p - jit->code;
+    jit->code_used = jit->code_start;
+}
+
+bool jit_init(Jit* jit, uint8_t* memory, uint8_t* registers, uint16_t* I, uint16_t* pc,
+              void (*interpret)(void*), void* context) {
+    memset(jit, 0, sizeof(*jit));
+    jit->memory = memory;
+    jit->registers = registers;
+    jit->I = I;
+    jit->pc = pc;
+    jit->interpret = interpret;
+    jit->context = context;
+
+    void* code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) return false;
+    jit->code = code;
+    jit_emit_trampoline(jit);
+    return true;
+}
+
+void jit_end(Jit* jit) {
+    if (jit->code) munmap(jit->code, JIT_CODE_SIZE);
+    jit->code = NULL;
+}
+
+// drop every translated block (the code buffer is reused from the start)
+void jit_flush(Jit* jit) {
+    memset(jit->entry, 0, sizeof(jit->entry));
+    memset(jit->length, 0, sizeof(jit->length));
+    memset(jit->translated, 0, sizeof(jit->translated));
+    jit->code_used = jit->code_start;
+    jit->flushes++;
+}
+
+// called for every store into memory, flushes if it hits translated code
+void jit_invalidate(Jit* jit, uint16_t addr, uint16_t length) {
+    for (int i = 0; i < length; i++) {
+        if (jit->translated[(addr + i) & 0xFFF]) {
+            jit_flush(jit);
+            return;
+        }
+    }
+}
+
+// translate the block starting at pc, returns its length in instructions (0 if nothing was translated)
+uint16_t jit_translate(Jit* jit, uint16_t pc) {
+    if (jit->code_used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE)
+        jit_flush(jit);
+
+    uint8_t* start = jit->code + jit->code_used;
+    uint8_t* p = start;
+    uint16_t addr = pc;
+    uint16_t length = 0;
+    bool done = false;
+    bool exit_to_c = false;
+
+    // if (budget < length) exit; budget -= length  (length is patched in once it's known)
+    jit_emit8(&p, 0x49); jit_emit8(&p, 0x81); jit_emit8(&p, 0xFF);            // cmp r15, imm32
+    uint8_t* cmp_length = p;
+    jit_emit32(&p, 0);
+    jit_emit8(&p, 0x0F); jit_emit8(&p, 0x82); jit_emit_rel32(&p, jit->exit); // jb exit
+    jit_emit8(&p, 0x49); jit_emit8(&p, 0x81); jit_emit8(&p, 0xEF);            // sub r15, imm32
+    uint8_t* sub_length = p;
+    jit_emit32(&p, 0);
+
+    while (!done) {
+        if (addr + 1 >= JIT_MEMORY_SIZE || length == JIT_MAX_BLOCK_LENGTH) {
+            jit_emit_set_pc(&p, addr);
+            break;
+        }
+
+        uint16_t opcode = jit->memory[addr] << 8 | jit->memory[addr + 1];
+        Command c = command_parse_opcode(opcode);
+        uint8_t nn = c.n & 0xFF;
+
+        jit->translated[addr] = 1;
+        jit->translated[addr + 1] = 1;
+        length++;
+
+        switch(c.handler) {
+            // mov Vx nn
+            case H_6XNN: {
+                jit_emit8(&p, 0xC6); jit_emit8(&p, 0x43); jit_emit8(&p, c.x); jit_emit8(&p, nn);
+                break;
+            }
+            // add Vx nn
+            case H_7XNN: {
+                jit_emit8(&p, 0x80); jit_emit8(&p, 0x43); jit_emit8(&p, c.x); jit_emit8(&p, nn);
+                break;
+            }
+            // mov/or/and/xor Vx Vy
+            case H_8XY0:
+            case H_8XY1:
+            case H_8XY2:
+            case H_8XY3: {
+                uint8_t ops[] = { 0x88, 0x08, 0x20, 0x30 }; // mov, or, and, xor [rbx + x], al
+                jit_emit_vx(&p, 0x8A, 0, c.y);               // mov al, Vy
+                jit_emit_vx(&p, ops[c.handler - H_8XY0], 0, c.x);
+                break;
+            }
+            // add Vx Vy  (VF = carry, computed before the add like the interpreter)
+            case H_8XY4: {
+                jit_emit_vx(&p, 0x8A, 0, c.x);                              // mov al, Vx
+                jit_emit_vx(&p, 0x02, 0, c.y);                              // add al, Vy
+                jit_emit8(&p, 0x0F); jit_emit8(&p, 0x92); jit_emit8(&p, 0xC1); // setc cl
+                jit_emit_vx(&p, 0x88, 1, 0xF);                              // mov VF, cl
+                jit_emit_vx(&p, 0x8A, 0, c.y);                              // mov al, Vy
+                jit_emit_vx(&p, 0x00, 0, c.x);                              // add Vx, al
+                break;
+            }
+            // sub Vx Vy  (VF = Vx >= Vy)
+            case H_8XY5: {
+                jit_emit_vx(&p, 0x8A, 0, c.x);                              // mov al, Vx
+                jit_emit_vx(&p, 0x3A, 0, c.y);                              // cmp al, Vy
+                jit_emit8(&p, 0x0F); jit_emit8(&p, 0x93); jit_emit8(&p, 0xC1); // setae cl
+                jit_emit_vx(&p, 0x88, 1, 0xF);                              // mov VF, cl
+                jit_emit_vx(&p, 0x8A, 0, c.y);                              // mov al, Vy
+                jit_emit_vx(&p, 0x28, 0, c.x);                              // sub Vx, al
+                break;
+            }
+            // subn Vx Vy  (VF = Vy >= Vx)
+            case H_8XY7: {
+                jit_emit_vx(&p, 0x8A, 0, c.y);                              // mov al, Vy
+                jit_emit_vx(&p, 0x3A, 0, c.x);                              // cmp al, Vx
+                jit_emit8(&p, 0x0F); jit_emit8(&p, 0x93); jit_emit8(&p, 0xC1); // setae cl
+                jit_emit_vx(&p, 0x88, 1, 0xF);                              // mov VF, cl
+                jit_emit_vx(&p, 0x8A, 0, c.y);                              // mov al, Vy
+                jit_emit_vx(&p, 0x2A, 0, c.x);                              // sub al, Vx
+                jit_emit_vx(&p, 0x88, 0, c.x);                              // mov Vx, al
+                break;
+            }
+            // shr Vx  (VF = LSB)
+            case H_8XY6: {
+                jit_emit_vx(&p, 0x8A, 0, c.x);                              // mov al, Vx
+                jit_emit8(&p, 0x88); jit_emit8(&p, 0xC1);                   // mov cl, al
+                jit_emit8(&p, 0x80); jit_emit8(&p, 0xE1); jit_emit8(&p, 0x01); // and cl, 1
+                jit_emit_vx(&p, 0x88, 1, 0xF);                              // mov VF, cl
+                jit_emit_vx(&p, 0x8A, 0, c.x);                              // mov al, Vx (x may be F)
+                jit_emit8(&p, 0xD0); jit_emit8(&p, 0xE8);                   // shr al, 1
+                jit_emit_vx(&p, 0x88, 0, c.x);                              // mov Vx, al
+                break;
+            }
+            // shl Vx  (VF = MSB)
+            case H_8XYE: {
+                jit_emit_vx(&p, 0x8A, 0, c.x);                              // mov al, Vx
+                jit_emit8(&p, 0x88); jit_emit8(&p, 0xC1);                   // mov cl, al
+                jit_emit8(&p, 0xC0); jit_emit8(&p, 0xE9); jit_emit8(&p, 0x07); // shr cl, 7
+                jit_emit_vx(&p, 0x88, 1, 0xF);                              // mov VF, cl
+                jit_emit_vx(&p, 0x8A, 0, c.x);                              // mov al, Vx (x may be F)
+                jit_emit8(&p, 0xD0); jit_emit8(&p, 0xE0);                   // shl al, 1
+                jit_emit_vx(&p, 0x88, 0, c.x);                              // mov Vx, al
+                break;
+            }
+            // mov I nnn
+            case H_ANNN: {
+                jit_emit8(&p, 0x66); jit_emit8(&p, 0x41); jit_emit8(&p, 0xC7); jit_emit8(&p, 0x04); jit_emit8(&p, 0x24);
+                jit_emit16(&p, c.n);
+                break;
+            }
+            // add I Vx
+            case H_FX1E: {
+                jit_emit8(&p, 0x0F); jit_emit8(&p, 0xB6); jit_emit8(&p, 0x43); jit_emit8(&p, c.x); // movzx eax, Vx
+                jit_emit8(&p, 0x66); jit_emit8(&p, 0x41); jit_emit8(&p, 0x01); jit_emit8(&p, 0x04); jit_emit8(&p, 0x24); // add [r12], ax
+                break;
+            }
+
+            // nop
+            case H_NOP: break;
+
+            // jmp nnn
+            case H_1NNN: {
+                jit_emit_set_pc(&p, c.n);
+                done = true;
+                break;
+            }
+            // jmp0 nnn
+            case H_BNNN: {
+                jit_emit8(&p, 0x0F); jit_emit8(&p, 0xB6); jit_emit8(&p, 0x43); jit_emit8(&p, 0x00); // movzx eax, V0
+                jit_emit8(&p, 0x05); jit_emit32(&p, c.n);                                          // add eax, nnn
+                jit_emit8(&p, 0x66); jit_emit8(&p, 0x41); jit_emit8(&p, 0x89); jit_emit8(&p, 0x45); jit_emit8(&p, 0x00); // mov [r13], ax
+                done = true;
+                break;
+            }
+            // se Vx nn
+            case H_3XNN:
+            // sne Vx nn
+            case H_4XNN: {
+                jit_emit8(&p, 0x80); jit_emit8(&p, 0x7B); jit_emit8(&p, c.x); jit_emit8(&p, nn); // cmp Vx, nn
+                jit_emit_skip(&p, addr, c.handler == H_3XNN ? 0x75 : 0x74);                     // jne / je
+                done = true;
+                break;
+            }
+            // se Vx Vy (skips when not equal, same as the interpreter)
+            case H_5XY0:
+            // sne Vx Vy
+            case H_9XY0: {
+                jit_emit_vx(&p, 0x8A, 0, c.x); // mov al, Vx
+                jit_emit_vx(&p, 0x3A, 0, c.y); // cmp al, Vy
+                jit_emit_skip(&p, addr, 0x74); // je
+                done = true;
+                break;
+            }
+
+            // control flow and memory stores run in the interpreter and end the block
+            case H_00EE:
+            case H_2NNN:
+            case H_EX9E:
+            case H_EXA1:
+            case H_FX33:
+            case H_FX55: {
+                jit_emit_callback(jit, &p, addr);
+                done = true;
+                break;
+            }
+
+            // mov Vx K may have to wait for a key, exit and invalid opcodes stop the machine,
+            // either way the caller has to notice
+#ifndef CHIP8_SCHIP
+            case H_00CN: case H_00FB: case H_00FC: case H_00FE: // invalid without SUPER-CHIP
+            case H_00FF: case H_FX30: case H_FX75: case H_FX85:
+#endif
+            case H_00DN: case H_5XY2: case H_5XY3: case H_F000: // XO-CHIP never runs with the JIT
+            case H_FN01: case H_F002: case H_FX3A:
+            case H_FX0A:
+            case H_00FD:
+            case H_INVALID: {
+                jit_emit_callback(jit, &p, addr);
+                exit_to_c = true;
+                done = true;
+                break;
+            }
+
+            // side effects (display, timers, rnd, ...) run in the interpreter
+            default: {
+                jit_emit_callback(jit, &p, addr);
+                break;
+            }
+        }
+        addr += 2;
+    }
+
+    if (length == 0) return 0;
+
+    if (exit_to_c) {
+        jit_emit8(&p, 0xE9); jit_emit_rel32(&p, jit->exit); // jmp exit
+    } else {
+        jit_emit_dispatch(jit, &p);
+    }
+    memcpy(cmp_length, &(uint32_t){ length }, 4);
+    memcpy(sub_length, &(uint32_t){ length }, 4);
+
+    jit->code_used += p - start;
+    jit->entry[pc] = start;
+    jit->length[pc] = length;
+    jit->blocks_translated++;
+    return length;
+}
+
+// run translated code starting at pc for at most `budget` instructions, returns the budget left
+// (the caller interprets single instructions whenever the block at pc doesn't fit or can't be translated)
+uint64_t jit_run(Jit* jit, uint64_t budget) {
+    uint16_t pc = *jit->pc;
+    if (pc + 1 >= JIT_MEMORY_SIZE) return budget;
+    if (jit->entry[pc] == NULL && jit_translate(jit, pc) == 0) return budget;
+    if (jit->length[pc] > budget) return budget;
+
+    return jit->enter(jit->entry[pc], budget);
+}
+
+#endif // CHIP8_JIT_H
@@ -2,7 +2,6 @@
 #define CHIP8_KEY_H
 
 #include <stdint.h>
-#include <ncurses.h>
 #include <stdbool.h>
 
 int char_to_hex_val(char c) {
@@ -18,23 +17,54 @@ int char_to_hex_val(char c) {
     return -1;
 }
 
-uint8_t get_hex_key_block() {
-    int key;
-    while (1) {
-        key = char_to_hex_val(getch());
-        if (key != -1)
-            return key;
-    }
+// Keypad state, updated by the frontend once per frame.
+//
+// Terminals only report key presses (and auto-repeats of held keys), never
+// releases, so a key counts as held until it hasn't been reported for a while.
+// The first window covers the terminal's initial auto-repeat delay, once repeats
+// arrive a much shorter window is enough.
+#define KEY_HOLD_FRAMES 20       // ~330 ms after the first press
+#define KEY_REPEAT_HOLD_FRAMES 4 // ~66 ms after an auto-repeat
+
+typedef struct {
+    uint16_t state;     // bit k is set while hex key k is held
+    uint16_t pressed;   // keys that went down during the last polled frame
+    uint16_t repeating; // held keys the terminal is auto-repeating
+    uint64_t last_seen[16];
+} Keypad;
+
+bool key_is_down(const Keypad* keypad, uint8_t key) {
+    return key < 16 && ((keypad->state >> key) & 1);
+}
+
+// take the lowest key pressed during the last frame, -1 if there was none
+int key_take_press(Keypad* keypad) {
+    if (keypad->pressed == 0) return -1;
+
+    int key = __builtin_ctz(keypad->pressed);
+    keypad->pressed &= keypad->pressed - 1;
+    return key;
 }
 
-int get_hex_key_timeout(int timeout_ms) {
-    timeout(timeout_ms);
-    int key = getch();
-    timeout(0);
-    if (key == ERR)
-        return -1;
+// the terminal reported hex key `key` during `frame`
+void key_report(Keypad* keypad, int key, uint64_t frame) {
+    uint16_t bit = 1 << key;
+    if (keypad->state & bit) keypad->repeating |= bit;
+    else                     keypad->pressed |= bit;
+    keypad->state |= bit;
+    keypad->last_seen[key] = frame;
+}
 
-    return char_to_hex_val(key);
+// release every key that hasn't been reported within its hold window
+void key_release_stale(Keypad* keypad, uint64_t frame) {
+    for (int key = 0; key < 16; key++) {
+        uint16_t bit = 1 << key;
+        uint64_t hold = (keypad->repeating & bit) ? KEY_REPEAT_HOLD_FRAMES : KEY_HOLD_FRAMES;
+        if ((keypad->state & bit) && frame - keypad->last_seen[key] > hold) {
+            keypad->state &= ~bit;
+            keypad->repeating &= ~bit;
+        }
+    }
 }
 
 #endif //CHIP8_KEY_H
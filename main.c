@@ -1,279 +1,354 @@
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <signal.h>
 
-#include "token.h"
-#include "command.h"
-#include "display.h"
 #include "util.h"
-#include "key.h"
-
-uint8_t memory[4096] = {0};
-uint16_t I = 0;              // index register (used for memory addresses)
-uint16_t pc = 0x200;         // program counter (0x200 is presumed entrypoint)
-uint8_t registers[16] = {0}; // V0-VF registers
-uint16_t stack[16] = {0};    // stack
-uint8_t sp = 0;              // stack pointer
-
-uint8_t delay_timer; // TODO: decrement at 60hz
-uint8_t sound_timer; // TODO: decrement at 60hz
-
-void step() {
-    uint16_t opcode = memory[pc] << 8 | memory[pc + 1]; // read big-endian 16-bit opcode
-    Command c = command_parse_opcode(opcode);
-
-    switch(c.type) {
-        // cls
-        case O_00E0: {
-            display_clear();
-            break;
-        }
-        // ret
-        case O_00EE: {
-            pc = stack[sp];
-            sp -= 1;
-            sp = (sp + 16) & 0xF; // wrap around
-            break;
-        }
-        // jmp nnn
-        case O_1NNN: {
-            pc = c.n - 2; // -2 because pc is incremented at end of step
-            break;
-        }
-        // call nnn
-        case O_2NNN: {
-            sp += 1;
-            sp = (sp + 16) & 0xF; // wrap around
-            stack[sp] = pc;
-            pc = c.n;
-            break;
-        }
+#include "chip8.h"
+#include "screen.h"
+#include "rewind.h"
+#include "replay.h"
+#include "export.h"
+#include "debug.h"
+#include "gdb.h"
 
-        // se Vx nn
-        case O_3XNN: {
-            if(registers[c.x] == (c.n & 0xFF)) pc += 2;
-            break;
-        }
-        // sne Vx nn
-        case O_4XNN: {
-            if(registers[c.x] != (c.n & 0xFF)) pc += 2;
-            break;
-        }
-        // se Vx Vy
-        case O_5XY0: {
-            if(registers[c.x] != registers[c.y]) pc += 2;
-            break;
-        }
+Chip8 vm;
+Rewind history;
+Export export;
+Debugger debugger;
+GdbStub gdb;
 
-        // mov Vx nn
-        case O_6XNN: {
-            registers[c.x] = c.n & 0xFF;
-            break;
-        }
-        // add Vx nn
-        case O_7XNN: {
-            registers[c.x] += c.n & 0xFF;
-            break;
-        }
+volatile sig_atomic_t quit = 0;
 
-        // mov Vx Vy
-        case O_8XY0: {
-            registers[c.x] = registers[c.y];
-            break;
-        }
-        // or Vx Vy
-        case O_8XY1: {
-            registers[c.x] |= registers[c.y];
-            break;
-        }
-        // and Vx Vy
-        case O_8XY2: {
-            registers[c.x] &= registers[c.y];
-            break;
-        }
-        // xor Vx Vy
-        case O_8XY3: {
-            registers[c.x] ^= registers[c.y];
-            break;
-        }
+void on_interrupt(int signal) {
+    (void)signal;
+    quit = 1;
+}
 
-        // add Vx Vy  (VF = 1 on carry)
-        case O_8XY4: {
-            if(registers[c.x] + registers[c.y] > 0xFF) registers[0xF] = 1;
-            else                                       registers[0xF] = 0;
+// write the profile if one was asked for (--profile only exists in CHIP8_PROFILE builds)
+void save_profile(const char* prefix) {
+#ifdef CHIP8_PROFILE
+    if (prefix != NULL && !profile_write(vm.profile, vm.memory, prefix)) {
+        fprintf(stderr, "Error: Could not write profile: %s\n", prefix);
+    }
+#else
+    (void)prefix;
+#endif
+}
 
-            registers[c.x] += registers[c.y];
-            break;
-        }
-        // sub Vx Vy  (VF = 0 on borrow)
-        case O_8XY5: {
-            if(registers[c.x] >= registers[c.y]) registers[0xF] = 1;
-            else                                 registers[0xF] = 0;
+// finish the frame export if there is one, a failure is reported but doesn't change the exit code
+void close_export(ExportTarget target) {
+    if (target != EXPORT_NONE && !export_close(&export)) {
+        fprintf(stderr, "Error: Could not write export: %s\n", export.path);
+    }
+}
 
-            registers[c.x] -= registers[c.y];
-            break;
-        }
-        // shr Vx  (VF = LSB)
-        case O_8XY6: {
-            registers[0xF] = registers[c.x] & 0x1; // LSB
-            registers[c.x] >>= 1;
-            break;
-        }
-        // subn Vx Vy  (VF = 0 on borrow)
-        case O_8XY7: {
-            if(registers[c.y] >= registers[c.x]) registers[0xF] = 1;
-            else                                 registers[0xF] = 0;
+void usage(const char* program) {
+    printf("Usage: %s [options] <input-bin>\n", program);
+    printf("Options:\n");
+    printf("  --ipf N        instructions per 60 Hz frame (default %d)\n", CHIP8_INSTRUCTIONS_PER_FRAME);
+    printf("  --vip-timing   use COSMAC VIP instruction timings instead of a fixed --ipf\n");
+    printf("  --turbo        don't wait for real time between frames (timers still tick per frame)\n");
+    printf("  --step         start paused in the debugger (s step, o step over, u run to return, g continue)\n");
+    printf("  --break SPEC   break at ADDR or ADDR:COND, e.g. 0x23A:V3==5 (V0-VF, I, DT, ST, SP; == != < <= > >=)\n");
+    printf("  --watch SPEC   break on a store to ADDR or FIRST-LAST\n");
+    printf("  --watch-i SPEC break when I is set to ADDR or into FIRST-LAST\n");
+    printf("  --gdb PORT     serve the GDB remote protocol on 127.0.0.1:PORT (or on a Unix socket if PORT is a path),\n");
+    printf("                 with --headless until gdb kills the machine (no --cycles, --frames is optional)\n");
+    printf("  --render MODE  ncurses (default), half (1x2 pixels per cell) or braille (2x4 pixels per cell)\n");
+    printf("  --headless     run without a terminal as fast as possible and dump the final state\n");
+    printf("  --cycles N     headless: stop after N instructions\n");
+    printf("  --frames N     headless: stop after N frames\n");
+    printf("  --out FILE     headless: write the state dump to FILE instead of stdout\n");
+    printf("  --seed N       seed for rnd Vx nn (default %d)\n", CHIP8_DEFAULT_SEED);
+    printf("  --record FILE  log every key press to FILE (rewind is disabled while recording)\n");
+    printf("  --replay FILE  headless: feed a recorded log back in and dump the state where it ended\n");
+    printf("  --export-pbm PRE   headless: write every frame that changed the display to PRE<frame>.pbm\n");
+    printf("  --export-raw FILE  headless: write every frame to FILE as raw 1 bit per pixel rows\n");
+    printf("  --export-pipe CMD  headless: the same raw stream into CMD's stdin (e.g. ffmpeg)\n");
+    printf("  --export-scale N   scale exported frames up N times (default 1, at most %d)\n", EXPORT_MAX_SCALE);
+#ifdef CHIP8_PROFILE
+    printf("  --profile PRE  write an execution profile to PRE.txt and PRE.folded on exit\n");
+#endif
+}
 
-            registers[c.x] = registers[c.y] - registers[c.x];
-            break;
-        }
-        // shl Vx  (VF = MSB)
-        case O_8XYE: {
-            registers[0xF] = (registers[c.x] >> 7) & 0x1; // MSB
-            registers[c.x] <<= 1;
-            break;
-        }
+int main(int argc, char** argv) {
+    const char* input_path = NULL;
+    const char* out_path = NULL;
+    bool headless = false;
+    bool step_mode = false;
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    uint64_t seed = CHIP8_DEFAULT_SEED;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    const char* profile_prefix = NULL;
+    ExportTarget export_target = EXPORT_NONE;
+    const char* export_path = NULL;
+    uint32_t export_scale = 1;
+    int render = SCREEN_NCURSES;
+    bool debug_invalid = false;
+    const char* gdb_spec = NULL;
 
-        // sne Vx Vy
-        case O_9XY0: {
-            if(registers[c.x] != registers[c.y]) pc += 2;
-            break;
-        }
+    if (!chip8_init(&vm)) {
+        printf("Error: Could not allocate the machine\n");
+        return 1;
+    }
 
-        // mov I nnn
-        case O_ANNN: {
-            I = c.n;
-            break;
-        }
-        // jmp0 nnn
-        case O_BNNN: {
-            pc = registers[0] + c.n - 2; // -2 because pc is incremented at end of step
-            break;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--step") == 0) {
+            step_mode = true;
+        } else if (strcmp(argv[i], "--break") == 0 && has_value) {
+            debug_invalid |= !debug_parse_breakpoint(&debugger, argv[++i]);
+        } else if (strcmp(argv[i], "--watch") == 0 && has_value) {
+            debug_invalid |= !debug_parse_watch(&debugger, argv[++i], false);
+        } else if (strcmp(argv[i], "--watch-i") == 0 && has_value) {
+            debug_invalid |= !debug_parse_watch(&debugger, argv[++i], true);
+        } else if (strcmp(argv[i], "--gdb") == 0 && has_value) {
+            gdb_spec = argv[++i];
+        } else if (strcmp(argv[i], "--render") == 0 && has_value) {
+            const char* mode = argv[++i];
+            if (strcmp(mode, "ncurses") == 0)      render = SCREEN_NCURSES;
+            else if (strcmp(mode, "half") == 0)    render = SCREEN_HALF_BLOCK;
+            else if (strcmp(mode, "braille") == 0) render = SCREEN_BRAILLE;
+            else                                   render = -1;
+        } else if (strcmp(argv[i], "--turbo") == 0) {
+            vm.clock.turbo = true;
+        } else if (strcmp(argv[i], "--vip-timing") == 0) {
+            vm.clock.vip_timing = true;
+        } else if (strcmp(argv[i], "--ipf") == 0 && has_value) {
+            vm.clock.instructions_per_frame = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--cycles") == 0 && has_value) {
+            cycles = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--out") == 0 && has_value) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--export-pbm") == 0 && has_value) {
+            export_target = EXPORT_PBM;
+            export_path = argv[++i];
+        } else if (strcmp(argv[i], "--export-raw") == 0 && has_value) {
+            export_target = EXPORT_RAW;
+            export_path = argv[++i];
+        } else if (strcmp(argv[i], "--export-pipe") == 0 && has_value) {
+            export_target = EXPORT_PIPE;
+            export_path = argv[++i];
+        } else if (strcmp(argv[i], "--export-scale") == 0 && has_value) {
+            export_scale = strtoul(argv[++i], NULL, 10);
+#ifdef CHIP8_PROFILE
+        } else if (strcmp(argv[i], "--profile") == 0 && has_value) {
+            profile_prefix = argv[++i];
+#endif
+        } else if (argv[i][0] == '-' || input_path != NULL) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            input_path = argv[i];
         }
+    }
 
-        // rnd Vx nn
-        case O_CXNN: {
-            registers[c.x] = rand() & (c.n & 0xFF);
-            break;
-        }
-        // drw Vx Vy n
-        case O_DXYN: {
-            registers[0xF] = display_draw_sprite(registers[c.x], registers[c.y], c.n & 0xF, memory + I);
-            break;
-        }
+    bool budget_missing = headless && cycles == 0 && frames == 0 && replay_path == NULL && gdb_spec == NULL;
+    bool debugging = step_mode || debug_checks(&debugger);
+    bool record_invalid = record_path != NULL && (headless || debugging || gdb_spec != NULL || replay_path != NULL);
+    debug_invalid |= debugging && (headless || replay_path != NULL);
+    debug_invalid |= gdb_spec != NULL && (replay_path != NULL || cycles > 0);
+    bool export_invalid = export_target != EXPORT_NONE && !headless && replay_path == NULL;
+    export_invalid |= export_scale == 0 || export_scale > EXPORT_MAX_SCALE;
+    if (input_path == NULL || budget_missing || record_invalid || export_invalid || debug_invalid || render < 0 ||
+        vm.clock.instructions_per_frame == 0) {
+        usage(argv[0]);
+        return 1;
+    }
 
-        // skp Vx
-        case O_EX9E: {
-            int key = get_hex_key_timeout(100);
-            if(key == registers[c.x]) pc += 2;
-            break;
-        }
-        // sknp Vx
-        case O_EXA1: {
-            int key = get_hex_key_timeout(100);
-            if(key != registers[c.x]) pc += 2;
-            break;
-        }
+    String input = {0};
+    if (!util_read_file(input_path, &input)) {
+        printf("Error: Could not read file: %s\n", input_path);
+        return 1;
+    }
+    if (!chip8_load(&vm, input.items, input.count)) {
+        printf("Error: File does not fit in memory: %s\n", input_path);
+        return 1;
+    }
+    uint64_t rom_hash = util_fnv1a(UTIL_FNV_OFFSET, input.items, input.count);
+    util_da_free(&input);
+    chip8_seed(&vm, seed);
 
-        // mov Vx DT
-        case O_FX07: {
-            registers[c.x] = delay_timer;
-            break;
-        }
-        // mov Vx K
-        case O_FX0A: {
-            registers[c.x] = get_hex_key_block();
-            break;
-        }
-        // mov DT Vx
-        case O_FX15: {
-            delay_timer = registers[c.x];
-            break;
-        }
-        // mov ST Vx
-        case O_FX18: {
-            sound_timer = registers[c.x];
-            break;
-        }
+    if (export_target != EXPORT_NONE && !export_open(&export, export_target, export_path, export_scale)) {
+        printf("Error: Could not open export: %s\n", export_path);
+        return 1;
+    }
 
-        // add I Vx
-        case O_FX1E: {
-            I += registers[c.x];
-            break;
-        }
-        // mov I Vx
-        case O_FX29: {
-            I = registers[c.x] * 5; // 5 bytes per character
-            break;
+    if (replay_path != NULL) {
+        Replay log;
+        ReplayHeader header;
+        if (!replay_open(&log, replay_path, &header)) {
+            printf("Error: Could not read input log: %s\n", replay_path);
+            return 1;
+        }
+        if (header.rom_hash != rom_hash) {
+            fprintf(stderr, "Warning: %s was recorded with a different ROM\n", replay_path);
+        }
+        chip8_seed(&vm, header.seed);
+        vm.clock.vip_timing = header.vip_timing;
+        vm.clock.instructions_per_frame = header.instructions_per_frame;
+
+        FILE* out = stdout;
+        if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+            printf("Error: Could not write file: %s\n", out_path);
+            return 1;
         }
 
-        // mov B Vx
-        case O_FX33: {
-            memory[I]     = (registers[c.x] / 100) % 10;
-            memory[I + 1] = (registers[c.x] / 10) % 10;
-            memory[I + 2] = (registers[c.x]) % 10;
-            break;
+        uint64_t executed = 0;
+        while (!replay_done(&log, vm.clock.frames) && vm.status != CHIP8_FAULT && vm.status != CHIP8_EXITED) {
+            replay_poll_keys(&log, &vm.keypad, vm.clock.frames);
+            executed += chip8_run_frame(&vm, UINT64_MAX);
+            if (export_target != EXPORT_NONE) export_frame(&export, &vm);
+        }
+        chip8_state_dump(&vm, out, executed);
+        close_export(export_target);
+
+        if (out != stdout) fclose(out);
+        replay_close(&log);
+        save_profile(profile_prefix);
+        chip8_end(&vm);
+        return 0;
+    }
+
+    if (headless) {
+        FILE* out = stdout;
+        if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+            printf("Error: Could not write file: %s\n", out_path);
+            return 1;
         }
-        // mov [I] Vx
-        case O_FX55: {
-            for(int i = 0; i <= c.x; i++) {
-                memory[I + i] = registers[i];
+
+        uint64_t executed = 0;
+        if (gdb_spec != NULL) {
+            if (!gdb_open(&gdb, gdb_spec)) {
+                printf("Error: Could not listen for gdb on: %s\n", gdb_spec);
+                return 1;
             }
-            break;
-        }
-        // mov Vx [I]
-        case O_FX65: {
-            for(int i = 0; i <= c.x; i++) {
-                registers[i] = memory[I + i];
+            signal(SIGINT, on_interrupt);
+
+            // served until gdb kills it, ^C or the end of --frames, in real time unless --turbo
+            debugger.mode = DEBUG_CONTINUE;
+            clock_start(&vm.clock);
+            while (!quit && (frames == 0 || vm.clock.frames < frames)) {
+                if (!gdb_poll(&gdb, &debugger, &vm)) break;
+                if (debug_fast(&debugger) && !debugger.in_frame) executed += chip8_run_frame(&vm, UINT64_MAX);
+                else executed += debug_run_frame(&debugger, &vm);
+                gdb_report_stop(&gdb, &debugger, &vm);
+                if (export_target != EXPORT_NONE) export_frame(&export, &vm);
+
+                bool idle = debugger.mode == DEBUG_PAUSED || vm.status == CHIP8_FAULT || vm.status == CHIP8_EXITED;
+                if (idle && vm.clock.turbo) usleep(CLOCK_FRAME_US);
+                clock_wait_frame(&vm.clock);
+            }
+            gdb_close(&gdb);
+        } else {
+            // nothing presses keys in a headless run, so waiting on mov Vx K ends it
+            while (vm.status == CHIP8_RUNNING && (frames > 0 ? vm.clock.frames < frames : executed < cycles)) {
+                executed += chip8_run_frame(&vm, frames > 0 ? UINT64_MAX : cycles - executed);
+                if (export_target != EXPORT_NONE) export_frame(&export, &vm);
             }
-            break;
         }
+        chip8_state_dump(&vm, out, executed);
+        close_export(export_target);
 
-        case 0: {
-            // printf("nop: %d\n", c.type);
-            break;
-        }
-        default: {
-            // printf("Unknown instruction: %d\n", c.type);
-            assert(0 && "ERROR: Unknown instruction");
-            break;
-        }
+        if (out != stdout) fclose(out);
+        save_profile(profile_prefix);
+        chip8_end(&vm);
+        return 0;
     }
 
-    pc += 2; // increment program counter one word
-}
-
-int main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("Usage: %s <input-bin>\n", argv[0]);
-        return 1;
+    Replay record_log;
+    Replay* record = NULL;
+    if (record_path != NULL) {
+        ReplayHeader header = {
+            .vip_timing = vm.clock.vip_timing,
+            .instructions_per_frame = vm.clock.instructions_per_frame,
+            .seed = seed,
+            .rom_hash = rom_hash,
+        };
+        if (!replay_record_open(&record_log, record_path, &header)) {
+            printf("Error: Could not write file: %s\n", record_path);
+            return 1;
+        }
+        record = &record_log;
     }
 
-    String input = {0};
-    if (!util_read_file(argv[1], &input)) {
-        printf("Error: Could not read file: %s\n", argv[1]);
+    if (gdb_spec != NULL && !gdb_open(&gdb, gdb_spec)) {
+        printf("Error: Could not listen for gdb on: %s\n", gdb_spec);
         return 1;
     }
-    memcpy(memory, input.items, input.count);
 
-    display_init();
-    display_clear();
+    // installed before ncurses so it leaves SIGINT to us, ^C then ends the loop cleanly
+    signal(SIGINT, on_interrupt);
+    screen_init(render);
+
+    rewind_init(&history);
+
+    // paused with --step, otherwise running until a breakpoint or watchpoint. Without any of them
+    // the whole frame goes through chip8_run_frame() as if there were no debugger.
+    debugger.mode = step_mode ? DEBUG_PAUSED : DEBUG_CONTINUE;
+
+    // the input log can't follow the machine back in time, so there's no rewind while recording
+    bool rewind_enabled = record == NULL;
+    if (rewind_enabled) rewind_capture(&history, &vm);
+
+    uint64_t shown = UINT64_MAX; // vm.presented as of the last screen_refresh()
+    clock_start(&vm.clock);
+    while (!quit) {
+        int rewinds = screen_poll_keys(&vm.keypad, vm.clock.frames, record);
+        for (size_t i = 0; i < screen_command_count && record == NULL; i++) {
+            if (debug_command(&debugger, &vm, screen_commands[i])) shown = UINT64_MAX;
+        }
+        if (gdb_spec != NULL && !gdb_poll(&gdb, &debugger, &vm)) break; // killed from gdb
 
-    while (1) {
-        display_refresh();
-        display_debug_info(pc, registers, I, sp, stack, memory, delay_timer, sound_timer);
-        while(get_hex_key_timeout(100) != 0);
+        uint64_t frame = vm.clock.frames;
+        if (rewinds > 0 && rewind_enabled) {
+            rewind_restore(&history, &vm, rewinds * REWIND_STEP_FRAMES);
+            debugger.in_frame = false; // the rest of that frame is gone
+        } else {
+            if (debug_fast(&debugger) && !debugger.in_frame) chip8_run_frame(&vm, UINT64_MAX);
+            else debug_run_frame(&debugger, &vm);
+            if (rewind_enabled && vm.clock.frames != frame) rewind_capture(&history, &vm);
+        }
+        if (gdb_spec != NULL) gdb_report_stop(&gdb, &debugger, &vm);
 
-        step();
-        display_refresh();
-        // sleep(1);
+        if (debugger.mode == DEBUG_PAUSED) {
+            Display back; // the back buffer, to see every drw as it happens
+            chip8_back_buffer(&vm, back);
+            screen_refresh(back);
+        } else if (shown != vm.presented) {
+            screen_refresh(vm.frame);
+            shown = vm.presented;
+        }
+        screen_debug_info(&vm);
+        screen_rewind_info(rewind_available(&history), history.bytes);
+        screen_debugger_info(&debugger);
+        screen_present();
+        if (debugger.mode == DEBUG_PAUSED && vm.clock.turbo) usleep(CLOCK_FRAME_US); // nothing to hurry for
+        clock_wait_frame(&vm.clock);
     }
 
-    display_end();
+    if (gdb_spec != NULL) gdb_close(&gdb);
+    if (record) replay_record_close(record, vm.clock.frames);
+    rewind_end(&history);
+    save_profile(profile_prefix);
+    chip8_end(&vm);
+    screen_end();
 
     return 0;
 }
@@ -0,0 +1,226 @@
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "util.h"
+#include "command.h"
+#include "clock.h"
+
+// Execution profiler, only compiled in with CHIP8_PROFILE.
+//
+// The interpreter calls profile_instruction() as it fetches every instruction.
+// The time between two fetches is charged to the earlier instruction's handler,
+// so handler times need nothing more than one timestamp per instruction.
+//
+// Calls are tracked through sp: a call at depth d records its target as frame
+// d + 1, so the frames 1..sp are the current call stack. Every instruction is
+// counted against that stack (identified by a hash built up frame by frame)
+// for the folded-stack output.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define profile_ticks() __rdtsc()
+#else
+#define profile_ticks() clock_now_ns()
+#endif
+
+#define PROFILE_STACK_SLOTS 4096 // distinct call stacks kept, must be a power of two
+#define PROFILE_TOP_PCS 20
+#define PROFILE_NO_HANDLER H_COUNT
+
+const char* profile_handler_names[H_COUNT] = {
+    [H_NOP]  = "NOP",  [H_00E0] = "00E0", [H_00EE] = "00EE", [H_1NNN] = "1NNN",
+    [H_2NNN] = "2NNN", [H_3XNN] = "3XNN", [H_4XNN] = "4XNN", [H_5XY0] = "5XY0",
+    [H_6XNN] = "6XNN", [H_7XNN] = "7XNN", [H_8XY0] = "8XY0", [H_8XY1] = "8XY1",
+    [H_8XY2] = "8XY2", [H_8XY3] = "8XY3", [H_8XY4] = "8XY4", [H_8XY5] = "8XY5",
+    [H_8XY6] = "8XY6", [H_8XY7] = "8XY7", [H_8XYE] = "8XYE", [H_9XY0] = "9XY0",
+    [H_ANNN] = "ANNN", [H_BNNN] = "BNNN", [H_CXNN] = "CXNN", [H_DXYN] = "DXYN",
+    [H_EX9E] = "EX9E", [H_EXA1] = "EXA1", [H_FX07] = "FX07", [H_FX0A] = "FX0A",
+    [H_FX15] = "FX15", [H_FX18] = "FX18", [H_FX1E] = "FX1E", [H_FX29] = "FX29",
+    [H_FX33] = "FX33", [H_FX55] = "FX55", [H_FX65] = "FX65", [H_INVALID] = "invalid",
+    [H_00CN] = "00CN", [H_00FB] = "00FB", [H_00FC] = "00FC", [H_00FD] = "00FD",
+    [H_00FE] = "00FE", [H_00FF] = "00FF", [H_FX30] = "FX30", [H_FX75] = "FX75",
+    [H_FX85] = "FX85", [H_00DN] = "00DN", [H_5XY2] = "5XY2", [H_5XY3] = "5XY3",
+    [H_F000] = "F000", [H_FN01] = "FN01", [H_F002] = "F002", [H_FX3A] = "FX3A",
+};
+
+typedef struct {
+    uint64_t hash;           // 0 = empty slot
+    uint64_t count;
+    uint8_t depth;
+    uint16_t frames[16];     // frames[0] is the entry point
+} ProfileStack;
+
+typedef struct {
+    uint64_t instructions;
+    uint64_t handler_count[H_COUNT];
+    uint64_t handler_ticks[H_COUNT];
+    uint64_t pc_hits[COMMAND_CACHE_SIZE];   // per word, odd pcs count to the word they start in
+    uint64_t depth_hits[16];                // instructions executed at each sp
+    uint8_t max_depth;
+
+    uint8_t last_handler;                   // handler the ticks since last_ticks belong to
+    uint64_t last_ticks;
+    uint64_t start_ticks, start_ns;         // to convert ticks to ns in the report
+
+    uint16_t frames[16];                    // call target at each depth
+    uint64_t frame_hash[16];                // hash of frames[0..d]
+    uint64_t stacks_dropped;                // instructions whose stack didn't fit the table
+    ProfileStack stacks[PROFILE_STACK_SLOTS];
+} Profile;
+
+uint64_t profile_mix(uint64_t hash, uint16_t frame) {
+    hash = (hash ^ frame) * UTIL_FNV_PRIME;
+    return hash ? hash : 1;
+}
+
+void profile_init(Profile* profile, uint16_t entry) {
+    memset(profile, 0, sizeof(*profile));
+    profile->last_handler = PROFILE_NO_HANDLER;
+    profile->frames[0] = entry;
+    profile->frame_hash[0] = profile_mix(UTIL_FNV_OFFSET, entry);
+    profile->start_ticks = profile_ticks();
+    profile->start_ns = clock_now_ns();
+}
+
+// charge the time since the last instruction started to its handler
+void profile_pause(Profile* profile) {
+    uint64_t now = profile_ticks();
+    if (profile->last_handler != PROFILE_NO_HANDLER) {
+        profile->handler_ticks[profile->last_handler] += now - profile->last_ticks;
+    }
+    profile->last_handler = PROFILE_NO_HANDLER;
+}
+
+void profile_count_stack(Profile* profile, uint8_t depth) {
+    uint64_t hash = profile->frame_hash[depth];
+    for (uint32_t probe = 0; probe < PROFILE_STACK_SLOTS; probe++) {
+        ProfileStack* slot = &profile->stacks[(hash + probe) & (PROFILE_STACK_SLOTS - 1)];
+        if (slot->hash == hash) {
+            slot->count++;
+            return;
+        }
+        if (slot->hash == 0) {
+            slot->hash = hash;
+            slot->count = 1;
+            slot->depth = depth;
+            memcpy(slot->frames, profile->frames, (depth + 1) * sizeof(uint16_t));
+            return;
+        }
+    }
+    profile->stacks_dropped++;
+}
+
+// the instruction `c` at `pc` is about to run with the stack pointer at `sp`
+void profile_instruction(Profile* profile, uint16_t pc, uint8_t sp, Command c) {
+    uint64_t now = profile_ticks();
+    if (profile->last_handler != PROFILE_NO_HANDLER) {
+        profile->handler_ticks[profile->last_handler] += now - profile->last_ticks;
+    }
+    profile->last_handler = c.handler;
+    profile->last_ticks = now;
+
+    profile->instructions++;
+    profile->handler_count[c.handler]++;
+    profile->pc_hits[(pc & COMMAND_ADDRESS_MASK) >> 1]++;
+    profile->depth_hits[sp & 0xF]++;
+    if (sp > profile->max_depth) profile->max_depth = sp;
+    profile_count_stack(profile, sp & 0xF);
+
+    if (c.handler == H_2NNN) {
+        uint8_t callee = (sp + 1) & 0xF;
+        profile->frames[callee] = c.n;
+        profile->frame_hash[callee] = profile_mix(callee ? profile->frame_hash[callee - 1] : UTIL_FNV_OFFSET, c.n);
+    }
+}
+
+// indices 0..count-1 ordered by descending value (insertion sort, the report is written once)
+void profile_order(const uint64_t* values, uint16_t* order, int count) {
+    for (int i = 0; i < count; i++) {
+        int j = i;
+        while (j > 0 && values[order[j - 1]] < values[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+}
+
+// human readable summary: time and count per handler, hottest pcs, call depths
+void profile_report(const Profile* profile, const uint8_t* memory, FILE* out) {
+    double ns_per_tick = 1.0;
+    uint64_t ticks = profile_ticks() - profile->start_ticks;
+    if (ticks > 0) ns_per_tick = (double)(clock_now_ns() - profile->start_ns) / ticks;
+    double total = profile->instructions ? (double)profile->instructions : 1.0;
+
+    fprintf(out, "instructions: %llu\n\n", (unsigned long long)profile->instructions);
+
+    fprintf(out, "%-8s %14s %7s %14s %10s\n", "handler", "count", "%", "time ns", "ns/instr");
+    uint16_t order[COMMAND_CACHE_SIZE];
+    profile_order(profile->handler_count, order, H_COUNT);
+    for (int i = 0; i < H_COUNT; i++) {
+        int h = order[i];
+        uint64_t count = profile->handler_count[h];
+        if (count == 0) break;
+        double ns = profile->handler_ticks[h] * ns_per_tick;
+        fprintf(out, "%-8s %14llu %6.2f%% %14.0f %10.2f\n", profile_handler_names[h], (unsigned long long)count,
+                100.0 * count / total, ns, ns / count);
+    }
+
+    fprintf(out, "\n%-6s %14s %7s  %s\n", "pc", "hits", "%", "opcode");
+    profile_order(profile->pc_hits, order, COMMAND_CACHE_SIZE);
+    for (int i = 0; i < PROFILE_TOP_PCS; i++) {
+        uint16_t slot = order[i];
+        uint64_t hits = profile->pc_hits[slot];
+        if (hits == 0) break;
+        uint16_t pc = slot << 1;
+        uint16_t opcode = memory[pc] << 8 | memory[pc + 1];
+        fprintf(out, "0x%03X  %14llu %6.2f%%  %04X %s\n", pc, (unsigned long long)hits, 100.0 * hits / total, opcode,
+                profile_handler_names[command_parse_opcode(opcode).handler]);
+    }
+
+    fprintf(out, "\n%-6s %14s %7s\n", "depth", "instructions", "%");
+    for (int d = 0; d <= profile->max_depth; d++) {
+        fprintf(out, "%-6d %14llu %6.2f%%\n", d, (unsigned long long)profile->depth_hits[d], 100.0 * profile->depth_hits[d] / total);
+    }
+    if (profile->stacks_dropped > 0) {
+        fprintf(out, "\n%llu instructions ran in call stacks that didn't fit the profile\n", (unsigned long long)profile->stacks_dropped);
+    }
+}
+
+// one line per call stack with its instruction count, as flamegraph.pl and friends read it
+void profile_write_folded(const Profile* profile, FILE* out) {
+    for (int i = 0; i < PROFILE_STACK_SLOTS; i++) {
+        const ProfileStack* stack = &profile->stacks[i];
+        if (stack->hash == 0) continue;
+
+        for (int d = 0; d <= stack->depth; d++) {
+            fprintf(out, d == 0 ? "0x%03X" : ";sub_0x%03X", stack->frames[d]);
+        }
+        fprintf(out, " %llu\n", (unsigned long long)stack->count);
+    }
+}
+
+// write PREFIX.txt (the report) and PREFIX.folded (the call stacks)
+bool profile_write(const Profile* profile, const uint8_t* memory, const char* prefix) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.txt", prefix);
+    FILE* report = fopen(path, "w");
+    if (report == NULL) return false;
+    profile_report(profile, memory, report);
+    fclose(report);
+
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    FILE* folded = fopen(path, "w");
+    if (folded == NULL) return false;
+    profile_write_folded(profile, folded);
+    fclose(folded);
+    return true;
+}
+
+#endif // CHIP8_PROFILE_H
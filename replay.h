@@ -0,0 +1,169 @@
+#ifndef CHIP8_REPLAY_H
+#define CHIP8_REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "key.h"
+
+// Input log for deterministic record/replay.
+//
+// The machine only sees input through the keypad, which the frontend updates
+// once per frame, so the log is every key report stamped with the frame it was
+// polled in. Together with the seed, timing mode and the ROM that reproduces
+// a run exactly.
+//
+// File layout (integers little-endian):
+//   header  "C8KL" version:u8 vip_timing:u8 ipf:u32 seed:u64 rom_hash:u64
+//   events  frame_delta:varint key:u8   (frame delta from the previous event)
+//   end     frame_delta:varint 0xFF     (frames run in total, missing if the recorder died)
+
+#define REPLAY_MAGIC "C8KL"
+#define REPLAY_VERSION 1
+#define REPLAY_END 0xFF
+
+typedef struct {
+    bool vip_timing;
+    uint32_t instructions_per_frame;
+    uint64_t seed;
+    uint64_t rom_hash;
+} ReplayHeader;
+
+typedef struct {
+    FILE* file;
+    uint64_t frame;      // frame of the last event written or read
+
+    // reading only
+    bool has_event;      // `event_key` at `frame` is pending
+    uint8_t event_key;
+    bool ended;          // the end record (or the end of the file) was reached
+} Replay;
+
+void replay_write_u64(FILE* file, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc((value >> (8 * i)) & 0xFF, file);
+    }
+}
+
+bool replay_read_u64(FILE* file, uint64_t* value, int bytes) {
+    *value = 0;
+    for (int i = 0; i < bytes; i++) {
+        int c = fgetc(file);
+        if (c == EOF) return false;
+        *value |= (uint64_t)c << (8 * i);
+    }
+    return true;
+}
+
+void replay_write_varint(FILE* file, uint64_t value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    fputc(value, file);
+}
+
+bool replay_read_varint(FILE* file, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF) return false;
+        *value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+bool replay_record_open(Replay* replay, const char* path, const ReplayHeader* header) {
+    memset(replay, 0, sizeof(*replay));
+    replay->file = fopen(path, "wb");
+    if (replay->file == NULL) return false;
+
+    fwrite(REPLAY_MAGIC, 1, 4, replay->file);
+    fputc(REPLAY_VERSION, replay->file);
+    fputc(header->vip_timing, replay->file);
+    replay_write_u64(replay->file, header->instructions_per_frame, 4);
+    replay_write_u64(replay->file, header->seed, 8);
+    replay_write_u64(replay->file, header->rom_hash, 8);
+    return true;
+}
+
+// hex key `key` was reported while polling for `frame`
+void replay_record_key(Replay* replay, uint64_t frame, uint8_t key) {
+    replay_write_varint(replay->file, frame - replay->frame);
+    fputc(key, replay->file);
+    replay->frame = frame;
+}
+
+// finish the log after `frames` frames have run
+void replay_record_close(Replay* replay, uint64_t frames) {
+    replay_record_key(replay, frames, REPLAY_END);
+    fclose(replay->file);
+}
+
+// read the next event into the pending slot
+void replay_advance(Replay* replay) {
+    uint64_t delta;
+    int key;
+    replay->has_event = false;
+    if (!replay_read_varint(replay->file, &delta) || (key = fgetc(replay->file)) == EOF) {
+        // cut off without an end record, still run the frame of the last event
+        if (!replay->ended) replay->frame++;
+        replay->ended = true;
+        return;
+    }
+
+    replay->frame += delta;
+    if (key > 0xF) {
+        replay->ended = true; // REPLAY_END (anything else isn't a key either)
+        return;
+    }
+    replay->has_event = true;
+    replay->event_key = key;
+}
+
+bool replay_open(Replay* replay, const char* path, ReplayHeader* header) {
+    memset(replay, 0, sizeof(*replay));
+    replay->file = fopen(path, "rb");
+    if (replay->file == NULL) return false;
+
+    char magic[4];
+    uint64_t version, vip_timing, ipf;
+    if (fread(magic, 1, 4, replay->file) != 4 || memcmp(magic, REPLAY_MAGIC, 4) != 0 ||
+        !replay_read_u64(replay->file, &version, 1) || version != REPLAY_VERSION ||
+        !replay_read_u64(replay->file, &vip_timing, 1) ||
+        !replay_read_u64(replay->file, &ipf, 4) ||
+        !replay_read_u64(replay->file, &header->seed, 8) ||
+        !replay_read_u64(replay->file, &header->rom_hash, 8)) {
+        fclose(replay->file);
+        return false;
+    }
+    header->vip_timing = vip_timing;
+    header->instructions_per_frame = ipf;
+
+    replay_advance(replay);
+    return true;
+}
+
+// feed the keys logged for `frame` into the keypad, the same way the terminal frontend polls
+void replay_poll_keys(Replay* replay, Keypad* keypad, uint64_t frame) {
+    keypad->pressed = 0;
+    while (replay->has_event && replay->frame == frame) {
+        key_report(keypad, replay->event_key, frame);
+        replay_advance(replay);
+    }
+    key_release_stale(keypad, frame);
+}
+
+// the frame the log ends at (once every event has been fed)
+bool replay_done(const Replay* replay, uint64_t frame) {
+    return replay->ended && frame >= replay->frame;
+}
+
+void replay_close(Replay* replay) {
+    fclose(replay->file);
+}
+
+#endif // CHIP8_REPLAY_H
@@ -0,0 +1,244 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "chip8.h"
+
+// Rewind history: one snapshot of the machine per frame in a ring buffer.
+//
+// Every REWIND_KEYFRAME_INTERVAL frames a full snapshot (keyframe) is stored,
+// the frames in between only store their XOR against that keyframe, run-length
+// encoded a word at a time. Most frames change a handful of bytes, so a delta
+// is a few dozen bytes and a second of history costs about one keyframe.
+//
+// The ring holds whole groups (a keyframe and its deltas) and drops the oldest
+// group at once, so a delta never outlives the keyframe it was taken against.
+
+#define REWIND_KEYFRAME_INTERVAL 60 // one keyframe per second
+#define REWIND_GROUPS 10            // ~10 seconds of history
+#define REWIND_CAPACITY (REWIND_KEYFRAME_INTERVAL * REWIND_GROUPS)
+#define REWIND_STEP_FRAMES 15       // frames undone per rewind key press
+
+// everything a snapshot restores (zeroed once, so the padding never differs)
+typedef struct {
+    uint8_t memory[CHIP8_MEMORY_SIZE];
+    DisplayRow display[DISPLAY_PLANES * DISPLAY_HEIGHT];
+    uint64_t frames;
+    uint64_t rng;
+    uint16_t stack[16];
+    uint8_t registers[16];
+    uint16_t I;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+#ifdef CHIP8_SCHIP
+    bool hires;
+    uint8_t rpl[16];
+#endif
+#ifdef CHIP8_XOCHIP
+    uint8_t planes;
+    uint8_t audio_pattern[16];
+    uint8_t pitch;
+#endif
+} RewindState;
+
+#define REWIND_STATE_WORDS (sizeof(RewindState) / sizeof(uint64_t))
+
+// a delta is a list of runs: words to skip, words that follow, then the XORed words
+// (the header is one word so the XORed words stay aligned)
+typedef struct {
+    uint32_t skip;
+    uint32_t count;
+} RewindRun;
+
+typedef struct {
+    uint8_t* data;       // raw RewindState for keyframes, runs for deltas
+    size_t size;
+    size_t capacity;
+} RewindEntry;
+
+typedef struct {
+    RewindEntry entries[REWIND_CAPACITY];
+    uint64_t oldest;     // sequence number of the oldest snapshot kept (always a keyframe)
+    uint64_t next;       // sequence number the next capture gets
+    size_t bytes;        // encoded size of everything kept
+
+    RewindState scratch;
+    uint8_t encoded[sizeof(RewindState) + (REWIND_STATE_WORDS + 1) * sizeof(RewindRun)]; // worst case delta
+} Rewind;
+
+_Static_assert(sizeof(RewindState) % sizeof(uint64_t) == 0, "RewindState is compared a word at a time");
+
+void rewind_init(Rewind* rewind) {
+    memset(rewind, 0, sizeof(*rewind));
+}
+
+void rewind_end(Rewind* rewind) {
+    for (size_t i = 0; i < REWIND_CAPACITY; i++) {
+        free(rewind->entries[i].data);
+    }
+}
+
+// number of frames that can be rewound
+uint64_t rewind_available(const Rewind* rewind) {
+    return rewind->next > rewind->oldest ? rewind->next - rewind->oldest - 1 : 0;
+}
+
+void rewind_pack(RewindState* state, const Chip8* vm) {
+    memcpy(state->memory, vm->memory, sizeof(state->memory));
+    memcpy(state->display, vm->display, sizeof(state->display));
+    memcpy(state->stack, vm->stack, sizeof(state->stack));
+    memcpy(state->registers, vm->registers, sizeof(state->registers));
+    state->frames = vm->clock.frames;
+    state->rng = vm->rng;
+    state->I = vm->I;
+    state->pc = vm->pc;
+    state->sp = vm->sp;
+    state->delay_timer = vm->delay_timer;
+    state->sound_timer = vm->sound_timer;
+#ifdef CHIP8_SCHIP
+    state->hires = vm->hires;
+    memcpy(state->rpl, vm->rpl, sizeof(state->rpl));
+#endif
+#ifdef CHIP8_XOCHIP
+    state->planes = vm->planes;
+    memcpy(state->audio_pattern, vm->audio_pattern, sizeof(state->audio_pattern));
+    state->pitch = vm->pitch;
+#endif
+}
+
+void rewind_unpack(const RewindState* state, Chip8* vm) {
+    chip8_load(vm, state->memory, sizeof(state->memory)); // refreshes the decoded cache (and the JIT)
+    memcpy(vm->display, state->display, sizeof(vm->display));
+    vm->display_dirty = true; // snapshots are taken between frames, so this is a complete one
+    chip8_present(vm);
+    memcpy(vm->stack, state->stack, sizeof(vm->stack));
+    memcpy(vm->registers, state->registers, sizeof(vm->registers));
+    vm->clock.frames = state->frames;
+    vm->rng = state->rng;
+    vm->I = state->I;
+    vm->pc = state->pc;
+    vm->sp = state->sp;
+    vm->delay_timer = state->delay_timer;
+    vm->sound_timer = state->sound_timer;
+#ifdef CHIP8_SCHIP
+    vm->hires = state->hires;
+    memcpy(vm->rpl, state->rpl, sizeof(vm->rpl));
+#endif
+#ifdef CHIP8_XOCHIP
+    vm->planes = state->planes;
+    memcpy(vm->audio_pattern, state->audio_pattern, sizeof(vm->audio_pattern));
+    vm->pitch = state->pitch;
+#endif
+    vm->status = CHIP8_RUNNING;
+}
+
+// XOR `state` against `key` into `out`, returns the encoded size
+size_t rewind_delta_encode(const uint64_t* key, const uint64_t* state, uint8_t* out) {
+    size_t size = 0;
+    size_t i = 0;
+    while (i < REWIND_STATE_WORDS) {
+        size_t start = i;
+        while (i < REWIND_STATE_WORDS && key[i] == state[i]) i++;
+        if (i == REWIND_STATE_WORDS) break;
+
+        RewindRun run = { .skip = i - start };
+        uint64_t* words = (uint64_t*)(out + size + sizeof(RewindRun));
+        while (i < REWIND_STATE_WORDS && key[i] != state[i]) {
+            words[run.count++] = key[i] ^ state[i];
+            i++;
+        }
+        memcpy(out + size, &run, sizeof(run));
+        size += sizeof(run) + run.count * sizeof(uint64_t);
+    }
+    return size;
+}
+
+// apply a delta onto a copy of its keyframe
+void rewind_delta_apply(uint64_t* state, const uint8_t* delta, size_t size) {
+    size_t offset = 0;
+    size_t i = 0;
+    while (offset < size) {
+        RewindRun run;
+        memcpy(&run, delta + offset, sizeof(run));
+        offset += sizeof(run);
+        i += run.skip;
+
+        const uint64_t* words = (const uint64_t*)(delta + offset);
+        for (size_t k = 0; k < run.count; k++) {
+            state[i++] ^= words[k];
+        }
+        offset += run.count * sizeof(uint64_t);
+    }
+}
+
+RewindEntry* rewind_entry(Rewind* rewind, uint64_t sequence) {
+    return &rewind->entries[sequence % REWIND_CAPACITY];
+}
+
+void rewind_store(Rewind* rewind, RewindEntry* entry, const void* data, size_t size) {
+    if (size > entry->capacity) {
+        entry->data = realloc(entry->data, size);
+        entry->capacity = size;
+    }
+    memcpy(entry->data, data, size);
+    rewind->bytes += size;
+    entry->size = size;
+}
+
+// record the state at the end of a frame
+void rewind_capture(Rewind* rewind, const Chip8* vm) {
+    uint64_t sequence = rewind->next++;
+
+    // make room by dropping the oldest group whole
+    if (sequence - rewind->oldest >= REWIND_CAPACITY) {
+        for (uint64_t s = rewind->oldest; s < rewind->oldest + REWIND_KEYFRAME_INTERVAL; s++) {
+            rewind->bytes -= rewind_entry(rewind, s)->size;
+            rewind_entry(rewind, s)->size = 0;
+        }
+        rewind->oldest += REWIND_KEYFRAME_INTERVAL;
+    }
+
+    RewindEntry* entry = rewind_entry(rewind, sequence);
+    rewind->bytes -= entry->size;
+    rewind_pack(&rewind->scratch, vm);
+
+    if (sequence % REWIND_KEYFRAME_INTERVAL == 0) {
+        rewind_store(rewind, entry, &rewind->scratch, sizeof(RewindState));
+        return;
+    }
+
+    const RewindEntry* key = rewind_entry(rewind, sequence - sequence % REWIND_KEYFRAME_INTERVAL);
+    size_t size = rewind_delta_encode((const uint64_t*)key->data, (const uint64_t*)&rewind->scratch, rewind->encoded);
+    rewind_store(rewind, entry, rewind->encoded, size);
+}
+
+// go back `frames` frames (as far as the history reaches) and forget everything after,
+// returns the number of frames actually rewound
+uint64_t rewind_restore(Rewind* rewind, Chip8* vm, uint64_t frames) {
+    uint64_t available = rewind_available(rewind);
+    if (frames > available) frames = available;
+    if (rewind->next == rewind->oldest) return 0;
+
+    uint64_t sequence = rewind->next - 1 - frames;
+    const RewindEntry* key = rewind_entry(rewind, sequence - sequence % REWIND_KEYFRAME_INTERVAL);
+    const RewindEntry* entry = rewind_entry(rewind, sequence);
+
+    memcpy(&rewind->scratch, key->data, sizeof(RewindState));
+    if (entry != key) rewind_delta_apply((uint64_t*)&rewind->scratch, entry->data, entry->size);
+    rewind_unpack(&rewind->scratch, vm);
+
+    for (uint64_t s = sequence + 1; s < rewind->next; s++) {
+        rewind->bytes -= rewind_entry(rewind, s)->size;
+        rewind_entry(rewind, s)->size = 0;
+    }
+    rewind->next = sequence + 1;
+    return frames;
+}
+
+#endif // CHIP8_REWIND_H
@@ -0,0 +1,225 @@
+#ifndef CHIP8_SCREEN_H
+#define CHIP8_SCREEN_H
+
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "display.h"
+#include "key.h"
+#include "chip8.h"
+#include "replay.h"
+#include "term.h"
+#include "debug.h"
+
+// Terminal frontend: the display and debug windows plus keyboard input, through
+// ncurses or, in the compact modes, through the plain ANSI renderer in term.h.
+
+typedef enum {
+    SCREEN_NCURSES = 0,
+    SCREEN_HALF_BLOCK,  // 1x2 pixels per cell
+    SCREEN_BRAILLE,     // 2x4 pixels per cell
+} ScreenMode;
+
+ScreenMode screen_mode = SCREEN_NCURSES;
+
+// last frame presented to the terminal, screen_refresh() only redraws what differs from it
+Display screen_presented = {0};
+bool screen_presented_valid = false;
+
+// cells emitted by the last screen_refresh() and over the whole run
+uint32_t screen_cells_written = 0;
+uint64_t screen_cells_written_total = 0;
+
+WINDOW* display_win;
+WINDOW* debug_win;
+
+void screen_init(ScreenMode mode) {
+    screen_mode = mode;
+    if (mode != SCREEN_NCURSES) {
+        term_init(mode == SCREEN_BRAILLE);
+        return;
+    }
+
+    initscr();
+    noecho();
+    cbreak();
+
+    display_win = newwin(DISPLAY_HEIGHT, DISPLAY_WIDTH, 0, 0);
+    debug_win = newwin(DISPLAY_HEIGHT, DISPLAY_WIDTH + 20, 0, DISPLAY_WIDTH + 1);
+    keypad(display_win, TRUE);
+    nodelay(display_win, TRUE);
+    wrefresh(display_win);
+    wrefresh(debug_win);
+
+    refresh();
+}
+
+void screen_end() {
+    if (screen_mode != SCREEN_NCURSES) {
+        term_end();
+        return;
+    }
+    endwin();
+}
+
+// send everything queued for this frame to the terminal (ncurses already has)
+void screen_present() {
+    if (screen_mode != SCREEN_NCURSES) term_flush();
+}
+
+void screen_refresh(const DisplayRow* display) {
+    if (screen_mode != SCREEN_NCURSES) {
+        term_refresh(display);
+        return;
+    }
+
+    screen_cells_written = 0;
+    for (int i = 0; i < DISPLAY_HEIGHT; i++) {
+        for (int w = 0; w < DISPLAY_WIDTH / 64; w++) {
+            uint64_t changed = display_row_word(display[i], w) ^ display_row_word(screen_presented[i], w);
+            if (!screen_presented_valid) changed = ~0ULL;
+
+            // walk the runs of changed cells from left to right, 64 at a time
+            while (changed) {
+                int start = __builtin_clzll(changed);
+                uint64_t rest = ~(changed << start);
+                int length = rest ? __builtin_clzll(rest) : 64 - start;
+
+                wmove(display_win, i, 64 * w + start);
+                for (int j = 64 * w + start; j < 64 * w + start + length; j++) {
+                    if (display_pixel(display, j, i))
+                        waddch(display_win, '0');
+                    else
+                        waddch(display_win, '.');
+                }
+                screen_cells_written += length;
+
+                if (start + length == 64) break;
+                changed &= ~0ULL >> (start + length);
+            }
+        }
+        screen_presented[i] = display[i];
+    }
+    screen_presented_valid = true;
+    screen_cells_written_total += screen_cells_written;
+
+    if (screen_cells_written > 0)
+        wrefresh(display_win);
+}
+
+void screen_debug_info(const Chip8* vm) {
+    if (screen_mode != SCREEN_NCURSES) {
+        term_status(vm);
+        return;
+    }
+
+    wmove(debug_win, 0, 0);
+
+    uint16_t addr = vm->pc & CHIP8_ADDRESS_MASK;
+    uint16_t opcode = vm->memory[addr] << 8 | vm->memory[(addr + 1) & CHIP8_ADDRESS_MASK];
+    wprintw(debug_win, "Opcode: %04X\n", opcode);
+    wprintw(debug_win, "PC:     %04X\n", vm->pc);
+    wprintw(debug_win, "I:      %04X\n", vm->I);
+    wprintw(debug_win, "SP:     %04X\n", vm->sp);
+
+    wprintw(debug_win, "\nRegisters:\n    ");
+    for (int i = 0; i < 16; i++) {
+        wprintw(debug_win, "V%X ", i);
+    }
+    wprintw(debug_win, "\n    ");
+    for (int i = 0; i < 16; i++) {
+        wprintw(debug_win, "%02X ", vm->registers[i]);
+    }
+
+    wprintw(debug_win, "\n\nStack: \n    ");
+    for (int i = 0; i < 16; i++) {
+        wprintw(debug_win, "%04X ", vm->stack[i]);
+    }
+
+    wprintw(debug_win, "\nMemory (+I) [%04X-%04X]:\n    ", vm->I, vm->I + 16);
+    for (int i = 0; i < 16; i++) {
+        wprintw(debug_win, "%02X ", vm->memory[(i + vm->I) & CHIP8_ADDRESS_MASK]);
+    }
+    wprintw(debug_win, "...\n");
+
+    wprintw(debug_win, "\nDelay Timer: %02X\n", vm->delay_timer);
+    wprintw(debug_win, "Sound Timer: %02X\n", vm->sound_timer);
+#ifdef CHIP8_XOCHIP
+    wprintw(debug_win, "Audio: %5.0f Hz ", chip8_audio_rate(vm)); // pattern bits per second
+    for (int i = 0; i < 16; i++) wprintw(debug_win, "%02X", vm->audio_pattern[i]);
+    wprintw(debug_win, "\n");
+#endif
+
+    wprintw(debug_win, "\nCells written: %4u (total %llu)\n", screen_cells_written, (unsigned long long)screen_cells_written_total);
+    wprintw(debug_win, "Status: %-12s\n", chip8_status_name(vm->status));
+
+    wrefresh(debug_win);
+}
+
+#define SCREEN_REWIND_KEY 'r'
+
+// show how much rewind history is kept, below the debug info
+void screen_rewind_info(uint64_t frames, size_t bytes) {
+    if (screen_mode != SCREEN_NCURSES) {
+        term_rewind_info(frames, bytes);
+        return;
+    }
+    wprintw(debug_win, "Rewind: %5.1f s (%zu KB)\n", frames / (double)CLOCK_FRAME_RATE, bytes / 1024);
+    wrefresh(debug_win);
+}
+
+// show the debugger's mode and why it last stopped, below the rewind info
+void screen_debugger_info(const Debugger* dbg) {
+    if (screen_mode != SCREEN_NCURSES) {
+        term_debugger_info(dbg);
+        return;
+    }
+    wprintw(debug_win, "Debugger: %-13s %-11s %04X\n", debug_mode_name(dbg->mode), debug_stop_name(dbg->stop),
+            dbg->stop_addr);
+    wprintw(debug_win, "Breakpoints: %2d  Watches: %2d\n", dbg->breakpoint_count, dbg->watch_count);
+    wprintw(debug_win, "[s]tep [o]ver [u]p [g]o [x]free [p]ause [k]break\n");
+    wrefresh(debug_win);
+}
+
+// the keys typed during the last screen_poll_keys() that are neither hex keys nor rewind,
+// for the debugger commands
+char screen_commands[256];
+size_t screen_command_count = 0;
+
+// read every pending key from the terminal into the keypad (and the input log when recording),
+// returns how often the rewind key was pressed
+int screen_poll_keys(Keypad* keypad, uint64_t frame, Replay* record) {
+    int rewinds = 0;
+    keypad->pressed = 0;
+    screen_command_count = 0;
+
+    char typed[256];
+    size_t count = 0;
+    if (screen_mode != SCREEN_NCURSES) {
+        count = term_read_keys(typed, sizeof(typed));
+    } else {
+        timeout(0);
+        int ch;
+        while (count < sizeof(typed) && (ch = getch()) != ERR) typed[count++] = ch;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (typed[i] == SCREEN_REWIND_KEY) {
+            rewinds++;
+            continue;
+        }
+        int key = char_to_hex_val(typed[i]);
+        if (key == -1) {
+            screen_commands[screen_command_count++] = typed[i];
+            continue;
+        }
+        key_report(keypad, key, frame);
+        if (record) replay_record_key(record, frame, key);
+    }
+    key_release_stale(keypad, frame);
+    return rewinds;
+}
+
+#endif // CHIP8_SCREEN_H
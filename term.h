@@ -0,0 +1,236 @@
+#ifndef CHIP8_TERM_H
+#define CHIP8_TERM_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "chip8.h"
+#include "debug.h"
+
+// Plain ANSI terminal frontend, the compact alternative to ncurses.
+//
+// Pixels are packed into Unicode cells, either 1x2 per cell with half blocks
+// (64x16 cells) or 2x4 per cell with braille (32x8 cells). Everything a frame
+// changes (the cells that differ from the last frame, the status lines) is
+// collected in one buffer of escape sequences and goes out with a single
+// write() in term_flush(). Input is read straight from stdin, with the terminal
+// in non-canonical mode and without echo.
+
+#define TERM_OUT_SIZE (32 * 1024)
+#define TERM_CELL_ROWS_MAX (DISPLAY_HEIGHT / 2)
+#define TERM_CELL_COLS_MAX DISPLAY_WIDTH
+#define TERM_NO_CELL 0xFFFF // never a cell code, forces a cell to be drawn
+#define TERM_STATUS_LINES 4
+#define TERM_LINE_SIZE 128
+#define TERM_LINE_GAP 8 // about what a cursor move costs
+
+typedef struct {
+    bool braille;            // 2x4 pixels per cell instead of 1x2
+    int cell_rows, cell_cols;
+    uint16_t cells[TERM_CELL_ROWS_MAX][TERM_CELL_COLS_MAX]; // what the terminal shows now
+    char lines[TERM_STATUS_LINES][TERM_LINE_SIZE];         // and below it
+
+    struct termios saved;    // terminal settings to restore on exit
+    bool saved_valid;
+
+    char items[TERM_OUT_SIZE];
+    size_t count;
+    uint64_t bytes_total;
+} Term;
+
+Term term;
+
+void term_puts(const char* text, size_t length) {
+    if (term.count + length > TERM_OUT_SIZE) return; // can't happen for one frame, but never overflow
+    memcpy(term.items + term.count, text, length);
+    term.count += length;
+}
+
+void term_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void term_printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(term.items + term.count, TERM_OUT_SIZE - term.count, format, args);
+    va_end(args);
+    if (length > 0) term.count += length;
+    if (term.count > TERM_OUT_SIZE) term.count = TERM_OUT_SIZE;
+}
+
+// one write() for everything the frame changed
+void term_flush() {
+    const char* data = term.items;
+    size_t length = term.count;
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break;
+        data += written;
+        length -= written;
+    }
+    term.bytes_total += term.count;
+    term.count = 0;
+}
+
+void term_init(bool braille) {
+    term.braille = braille;
+    term.cell_rows = braille ? DISPLAY_HEIGHT / 4 : DISPLAY_HEIGHT / 2;
+    term.cell_cols = braille ? DISPLAY_WIDTH / 2 : DISPLAY_WIDTH;
+    for (int r = 0; r < TERM_CELL_ROWS_MAX; r++) {
+        for (int c = 0; c < TERM_CELL_COLS_MAX; c++) term.cells[r][c] = TERM_NO_CELL;
+    }
+    memset(term.lines, 0, sizeof(term.lines));
+
+    if (tcgetattr(STDIN_FILENO, &term.saved) == 0) {
+        struct termios raw = term.saved;
+        raw.c_lflag &= ~(ICANON | ECHO); // ISIG stays, ^C still ends the run
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        term.saved_valid = true;
+    }
+
+    // alternate screen, hidden cursor, cleared
+    term_printf("\x1b[?1049h\x1b[?25l\x1b[2J");
+    term_flush();
+}
+
+void term_end() {
+    term_printf("\x1b[?25h\x1b[?1049l");
+    term_flush();
+    if (term.saved_valid) tcsetattr(STDIN_FILENO, TCSANOW, &term.saved);
+}
+
+// half blocks: bit 1 is the upper pixel, bit 0 the lower one
+uint16_t term_half_cell(const DisplayRow* display, int row, int col) {
+    return display_pixel(display, col, 2 * row) << 1 | display_pixel(display, col, 2 * row + 1);
+}
+
+// braille: the offset from U+2800, dots 1-3 and 4-6 run down the two columns, 7 and 8 are the bottom row
+uint16_t term_braille_cell(const DisplayRow* display, int row, int col) {
+    static const uint8_t dots[4][2] = { {0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80} };
+    uint16_t cell = 0;
+    for (int y = 0; y < 4; y++) {
+        uint8_t pair = display[4 * row + y] >> (DISPLAY_WIDTH - 2 - 2 * col) & 0x3;
+        if (pair & 2) cell |= dots[y][0];
+        if (pair & 1) cell |= dots[y][1];
+    }
+    return cell;
+}
+
+// UTF-8 bytes term_put_cell() sends for `cell`
+int term_cell_size(uint16_t cell) {
+    return term.braille || cell != 0 ? 3 : 1;
+}
+
+void term_put_cell(uint16_t cell) {
+    if (term.braille) {
+        uint8_t glyph[3] = { 0xE2, 0xA0 | cell >> 6, 0x80 | (cell & 0x3F) }; // UTF-8 of U+2800 + cell
+        term_puts((const char*)glyph, 3);
+        return;
+    }
+    static const char* glyphs[4] = { " ", "\xE2\x96\x84", "\xE2\x96\x80", "\xE2\x96\x88" }; // lower, upper, full block
+    term_puts(glyphs[cell], term_cell_size(cell));
+}
+
+// queue the cells that differ from what the terminal shows. Each row starts with a cursor move,
+// gaps between changed cells are skipped with a relative move or printed again, whatever is shorter.
+void term_refresh(const DisplayRow* display) {
+    uint16_t row[TERM_CELL_COLS_MAX];
+    for (int r = 0; r < term.cell_rows; r++) {
+        int at = -1; // column the cursor is at, -1 until something in this row was sent
+        for (int c = 0; c < term.cell_cols; c++) {
+            row[c] = term.braille ? term_braille_cell(display, r, c) : term_half_cell(display, r, c);
+            if (row[c] == term.cells[r][c]) continue;
+
+            if (at < 0) {
+                term_printf("\x1b[%d;%dH", r + 1, c + 1);
+            } else if (at < c) {
+                int reprint = 0;
+                for (int i = at; i < c; i++) reprint += term_cell_size(row[i]);
+                if (reprint <= 4) {
+                    for (int i = at; i < c; i++) term_put_cell(row[i]);
+                } else {
+                    term_printf("\x1b[%dC", c - at);
+                }
+            }
+            term_put_cell(row[c]);
+            term.cells[r][c] = row[c];
+            at = c + 1;
+        }
+    }
+}
+
+// status line `line` below the picture, only the runs of characters that changed are sent
+void term_line(int line, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void term_line(int line, const char* format, ...) {
+    char text[TERM_LINE_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length >= TERM_LINE_SIZE) length = TERM_LINE_SIZE - 1;
+
+    char* shown = term.lines[line];
+    int shown_length = strlen(shown);
+    int at = -1; // column the cursor is at after the last run, -1 before the first one
+    for (int i = 0; i < length; i++) {
+        if (i < shown_length && text[i] == shown[i]) continue;
+        // a short gap of unchanged characters is cheaper to print again than to move over
+        if (at < 0 || i - at > TERM_LINE_GAP) term_printf("\x1b[%d;%dH", term.cell_rows + 2 + line, i + 1);
+        else term_puts(text + at, i - at);
+        term_puts(text + i, 1);
+        at = i + 1;
+    }
+    if (length < shown_length) term_printf("\x1b[%d;%dH\x1b[K", term.cell_rows + 2 + line, length + 1);
+    memcpy(shown, text, length + 1);
+}
+
+void term_status(const Chip8* vm) {
+    const uint8_t* v = vm->registers;
+    term_line(0, "PC %04X  I %04X  SP %X  DT %02X  ST %02X  %s", vm->pc, vm->I, vm->sp, vm->delay_timer,
+              vm->sound_timer, chip8_status_name(vm->status));
+    term_line(1, "%02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X", v[0], v[1],
+              v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11], v[12], v[13], v[14], v[15]);
+}
+
+void term_rewind_info(uint64_t frames, size_t bytes) {
+    term_line(2, "Rewind %.1f s (%zu KB)  out %llu KB", frames / (double)CLOCK_FRAME_RATE, bytes / 1024,
+              (unsigned long long)term.bytes_total / 1024);
+}
+
+void term_debugger_info(const Debugger* dbg) {
+    term_line(3, "%s %s %04X  bp %d  watch %d", debug_mode_name(dbg->mode), debug_stop_name(dbg->stop),
+              dbg->stop_addr, dbg->breakpoint_count, dbg->watch_count);
+}
+
+// every byte typed since the last call, escape sequences (arrow keys, ...) are dropped
+size_t term_read_keys(char* keys, size_t size) {
+    ssize_t length = read(STDIN_FILENO, keys, size);
+    if (length <= 0) return 0;
+    size_t kept = 0;
+    for (ssize_t i = 0; i < length; i++) {
+        if (keys[i] != '\x1b') {
+            keys[kept++] = keys[i];
+            continue;
+        }
+        // ESC [ parameters intermediates final (CSI), ESC O final (SS3) or ESC and one key (alt)
+        if (i + 1 < length && keys[i + 1] == '[') {
+            i += 2;
+            while (i < length && keys[i] >= 0x20 && keys[i] <= 0x3F) i++;
+        } else if (i + 1 < length && keys[i + 1] == 'O') {
+            i += 2;
+        } else {
+            i++;
+        }
+    }
+    return kept;
+}
+
+#endif // CHIP8_TERM_H
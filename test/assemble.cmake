@@ -0,0 +1,58 @@
+# Assembles SOURCE with one thread and with four and fails unless both give the same bytes
+# and the same warnings, and, with GOLDEN set, unless those bytes match the GOLDEN image.
+#
+#   cmake -DCHIP8ASM=<chip8asm> -DSOURCE=<asm> -DWORK=<dir> [-DGOLDEN=<bin>] [-DREPEAT=<n>] -P assemble.cmake
+#
+# Sources under 256 KB are always assembled on one thread, REPEAT concatenates SOURCE n times,
+# each copy followed by a blank line, so the chunked parallel path gets run too.
+
+foreach(var CHIP8ASM SOURCE WORK)
+    if(NOT DEFINED ${var})
+        message(FATAL_ERROR "assemble.cmake: ${var} is not set")
+    endif()
+endforeach()
+
+get_filename_component(name "${SOURCE}" NAME_WE)
+file(MAKE_DIRECTORY "${WORK}")
+
+set(input "${SOURCE}")
+if(DEFINED REPEAT)
+    file(READ "${SOURCE}" block)
+    string(APPEND block "\n")
+    string(REPEAT "${block}" ${REPEAT} large)
+    set(name "${name}-x${REPEAT}")
+    set(input "${WORK}/${name}.asm")
+    file(WRITE "${input}" "${large}")
+endif()
+
+foreach(threads 1 4)
+    execute_process(
+        COMMAND "${CHIP8ASM}" -q -j ${threads} "${input}" "${WORK}/${name}-j${threads}.bin"
+        RESULT_VARIABLE result
+        OUTPUT_VARIABLE warnings${threads}
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "chip8asm -j ${threads} ${input} failed: ${result}")
+    endif()
+endforeach()
+
+execute_process(
+    COMMAND "${CMAKE_COMMAND}" -E compare_files "${WORK}/${name}-j1.bin" "${WORK}/${name}-j4.bin"
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${name}: chip8asm -j 4 output differs from -j 1")
+endif()
+if(NOT warnings1 STREQUAL warnings4)
+    message(FATAL_ERROR "${name}: chip8asm -j 4 warnings differ from -j 1:\n${warnings1}\nvs\n${warnings4}")
+endif()
+
+if(DEFINED GOLDEN)
+    execute_process(
+        COMMAND "${CMAKE_COMMAND}" -E compare_files "${GOLDEN}" "${WORK}/${name}-j1.bin"
+        RESULT_VARIABLE result
+    )
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${name}: chip8asm output differs from ${GOLDEN}")
+    endif()
+endif()
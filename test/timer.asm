@@ -0,0 +1,7 @@
+mov V0 30
+mov DT V0
+mov V1 DT
+se V1 0
+jmp 516
+mov V2 1
+jmp 522
@@ -2,8 +2,10 @@
 #define CHIP8_TOKEN_H
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -42,8 +44,24 @@
 // and  Vx Vy    |  O_8XY2  |  0x8012
 // or   Vx Vy    |  O_8XY1  |  0x8011
 // xor  Vx Vy    |  O_8XY3  |  0x8013
-// shr  Vx       |  O_8XY6  |  0x8016   (VF = LSB)
-// shl  Vx       |  O_8XYE  |  0x801E   (VF = MSB)
+// shr  Vx [Vy]  |  O_8XY6  |  0x8016   (VF = LSB)
+// shl  Vx [Vy]  |  O_8XYE  |  0x801E   (VF = MSB)
+// scd  N        |  O_00CN  |  0x00CF   (SUPER-CHIP from here on)
+// scr           |  O_00FB  |  0x00FB
+// scl           |  O_00FC  |  0x00FC
+// exit          |  O_00FD  |  0x00FD
+// low           |  O_00FE  |  0x00FE
+// high          |  O_00FF  |  0x00FF
+// mov  HF Vx    |  O_FX30  |  0xF030
+// mov  R Vx     |  O_FX75  |  0xF075
+// mov  Vx R     |  O_FX85  |  0xF085
+// scu  N        |  O_00DN  |  0x00DF   (XO-CHIP from here on)
+// save Vx Vy    |  O_5XY2  |  0x5012
+// load Vx Vy    |  O_5XY3  |  0x5013
+// long addr     |  O_F000  |  0xF000   (followed by the 16 bit address)
+// plane N       |  O_FN01  |  0xF001
+// audio         |  O_F002  |  0xF002
+// pitch Vx      |  O_FX3A  |  0xF03A
 
 // opcode to enum value substitution: X->0, Y->1, N->F
 // - look at name-of-enum vs enum-value to translate
@@ -82,7 +100,27 @@ typedef enum {
     O_FX29 = 0xF029, // I = hex VX        (set I to a hex character)
     O_FX33 = 0xF033, // bcd VX            (decode VX into binary coded decimal)
     O_FX55 = 0xF055, // save VX           (save V0-VX to memory[I:I+X])
-    O_FX65 = 0xF065  // load VX           (load V0-VX from memory[I:I+X])
+    O_FX65 = 0xF065, // load VX           (load V0-VX from memory[I:I+X])
+
+    // SUPER-CHIP (only executed by CHIP8_SCHIP builds)
+    O_00CN = 0x00CF, // scroll down N     (pixel rows)
+    O_00FB = 0x00FB, // scroll right      (4 pixels)
+    O_00FC = 0x00FC, // scroll left       (4 pixels)
+    O_00FD = 0x00FD, // exit              (stop the machine)
+    O_00FE = 0x00FE, // low resolution    (64x32)
+    O_00FF = 0x00FF, // high resolution   (128x64)
+    O_FX30 = 0xF030, // I = big hex VX    (set I to a 10 byte hex character)
+    O_FX75 = 0xF075, // save flags VX     (save V0-VX to the RPL flags)
+    O_FX85 = 0xF085, // load flags VX     (load V0-VX from the RPL flags)
+
+    // XO-CHIP (only executed by CHIP8_XOCHIP builds)
+    O_00DN = 0x00DF, // scroll up N       (pixel rows)
+    O_5XY2 = 0x5012, // save VX-VY        (save VX..VY to memory[I:], I unchanged)
+    O_5XY3 = 0x5013, // load VX-VY        (load VX..VY from memory[I:], I unchanged)
+    O_F000 = 0xF000, // I = long NNNN     (the address is the next word)
+    O_FN01 = 0xF001, // plane N           (select the planes drawing, cls and scrolls apply to)
+    O_F002 = 0xF002, // audio             (load the 16 byte audio pattern from memory[I:])
+    O_FX3A = 0xF03A  // pitch VX          (set the audio pattern's playback rate)
 } OpcodeType;
 
 // Tokens:
@@ -106,6 +144,19 @@ typedef enum {
 // - xor
 // - shr
 // - shl
+// - scd
+// - scr
+// - scl
+// - exit
+// - low
+// - high
+// - scu
+// - save
+// - load
+// - long
+// - plane
+// - audio
+// - pitch
 //   Possible arguments:
 //   - [I]
 //   - I
@@ -114,6 +165,8 @@ typedef enum {
 //   - DT
 //   - ST
 //   - F
+//   - HF
+//   - R
 //   - Vx
 //   - addr/byte/N -> int
 typedef enum {
@@ -139,6 +192,19 @@ typedef enum {
     T_XOR,
     T_SHR,
     T_SHL,
+    T_SCD,
+    T_SCR,
+    T_SCL,
+    T_EXIT,
+    T_LOW,
+    T_HIGH,
+    T_SCU,
+    T_SAVE,
+    T_LOAD,
+    T_LONG,
+    T_PLANE,
+    T_AUDIO,
+    T_PITCH,
     // Literals
     T_VX,
     T_I,
@@ -148,6 +214,8 @@ typedef enum {
     T_DT,
     T_ST,
     T_F,
+    T_HF,
+    T_R,
     // Extra
     T_NUM,
 } Literal;
@@ -159,87 +227,181 @@ typedef struct {
 
 typedef struct {
     uint16_t opcode;
+    uint16_t address;  // long: the word that follows the opcode
     uint8_t arg_count;
     Token args[4];
 } Instruction;
 
+// Tokens are classified in place (the line doesn't have to be writable or
+// null-terminated): a switch on the length, then on the first character,
+// leaves at most one memcmp per token.
+#define TOKEN_IS(str, length, literal) (memcmp((str), (literal), (length)) == 0)
 
-char* token_next(char* line) {
-    while (*line != ' ' && *line != '\0') {
-        line++;
+Literal token_classify_word(const char* str, size_t length) {
+    switch (length) {
+        case 1: {
+            switch (str[0]) {
+                case 'I': return T_I;
+                case 'K': return T_K;
+                case 'B': return T_B;
+                case 'F': return T_F;
+                case 'R': return T_R;
+            }
+            break;
+        }
+        case 2: {
+            switch (str[0]) {
+                case 's': if (str[1] == 'e') return T_SE;   break;
+                case 'o': if (str[1] == 'r') return T_OR;   break;
+                case 'D': if (str[1] == 'T') return T_DT;   break;
+                case 'S': if (str[1] == 'T') return T_ST;   break;
+                case 'H': if (str[1] == 'F') return T_HF;   break;
+            }
+            break;
+        }
+        case 3: {
+            switch (str[0]) {
+                case 'c': if (TOKEN_IS(str, 3, "cls")) return T_CLS; break;
+                case 'd': if (TOKEN_IS(str, 3, "drw")) return T_DRW; break;
+                case 'j': if (TOKEN_IS(str, 3, "jmp")) return T_JMP; break;
+                case 'm': if (TOKEN_IS(str, 3, "mov")) return T_MOV; break;
+                case 'x': if (TOKEN_IS(str, 3, "xor")) return T_XOR; break;
+                case 'l': if (TOKEN_IS(str, 3, "low")) return T_LOW; break;
+                case '[': if (TOKEN_IS(str, 3, "[I]")) return T_ADDR_I; break;
+                case 'r': {
+                    if (TOKEN_IS(str, 3, "rnd")) return T_RND;
+                    if (TOKEN_IS(str, 3, "ret")) return T_RET;
+                    break;
+                }
+                case 's': {
+                    if (TOKEN_IS(str, 3, "sne")) return T_SNE;
+                    if (TOKEN_IS(str, 3, "skp")) return T_SKP;
+                    if (TOKEN_IS(str, 3, "sub")) return T_SUB;
+                    if (TOKEN_IS(str, 3, "shr")) return T_SHR;
+                    if (TOKEN_IS(str, 3, "shl")) return T_SHL;
+                    if (TOKEN_IS(str, 3, "scd")) return T_SCD;
+                    if (TOKEN_IS(str, 3, "scr")) return T_SCR;
+                    if (TOKEN_IS(str, 3, "scl")) return T_SCL;
+                    if (TOKEN_IS(str, 3, "scu")) return T_SCU;
+                    break;
+                }
+                case 'a': {
+                    if (TOKEN_IS(str, 3, "add")) return T_ADD;
+                    if (TOKEN_IS(str, 3, "and")) return T_AND;
+                    break;
+                }
+            }
+            break;
+        }
+        case 4: {
+            switch (str[0]) {
+                case 'c': if (TOKEN_IS(str, 4, "call")) return T_CALL; break;
+                case 'j': if (TOKEN_IS(str, 4, "jmp0")) return T_JMP0; break;
+                case 'e': if (TOKEN_IS(str, 4, "exit")) return T_EXIT; break;
+                case 'h': if (TOKEN_IS(str, 4, "high")) return T_HIGH; break;
+                case 's': {
+                    if (TOKEN_IS(str, 4, "sknp")) return T_SKNP;
+                    if (TOKEN_IS(str, 4, "subn")) return T_SUBN;
+                    if (TOKEN_IS(str, 4, "save")) return T_SAVE;
+                    break;
+                }
+                case 'l': {
+                    if (TOKEN_IS(str, 4, "load")) return T_LOAD;
+                    if (TOKEN_IS(str, 4, "long")) return T_LONG;
+                    break;
+                }
+            }
+            break;
+        }
+        case 5: {
+            switch (str[0]) {
+                case 'p': {
+                    if (TOKEN_IS(str, 5, "plane")) return T_PLANE;
+                    if (TOKEN_IS(str, 5, "pitch")) return T_PITCH;
+                    break;
+                }
+                case 'a': if (TOKEN_IS(str, 5, "audio")) return T_AUDIO; break;
+            }
+            break;
+        }
     }
-    while (*line == ' ') {
-        *line = '\0';
-        line++;
+    return T_INVALID;
+}
+
+// leading hex digits as strtol(str, NULL, 16) would read them
+int token_hex_value(const char* str, size_t length) {
+    size_t i = 0;
+    while (i < length && isspace((unsigned char)str[i])) i++;
+    bool negative = i < length && str[i] == '-';
+    if (i < length && (str[i] == '-' || str[i] == '+')) i++;
+    if (i + 2 < length && str[i] == '0' && (str[i + 1] == 'x' || str[i + 1] == 'X') && isxdigit((unsigned char)str[i + 2])) {
+        i += 2;
+    }
+
+    unsigned value = 0; // wraps instead of overflowing on absurd literals
+    for (; i < length; i++) {
+        char c = str[i];
+        int digit;
+        if (c >= '0' && c <= '9')      digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else break;
+        value = value * 16 + digit;
     }
-    return line;
+    return (int)(negative ? 0u - value : value);
 }
 
-Instruction token_extract_from_line(char* line) {
-    Instruction instruction = {0};
+// leading decimal number as atoi(str) would read it
+int token_int_value(const char* str, size_t length) {
+    size_t i = 0;
+    while (i < length && isspace((unsigned char)str[i])) i++;
+    bool negative = i < length && str[i] == '-';
+    if (i < length && (str[i] == '-' || str[i] == '+')) i++;
+    unsigned value = 0;
+    for (; i < length && str[i] >= '0' && str[i] <= '9'; i++) {
+        value = value * 10 + (str[i] - '0');
+    }
+    return (int)(negative ? 0u - value : value);
+}
 
-    char* str = (char*)malloc(2048); // assuming that lines will be <2048 chars ((probably))
-    char* start = str; // hold on to pointer to free later
-    memset(str, 0, 2048);
-    strcpy(str, line);
+void token_classify(Token* token, const char* str, size_t length) {
+    token->literal = token_classify_word(str, length);
+    if (token->literal != T_INVALID) return;
 
-    // remove leading spaces
-    while(*str == ' ') str++;
+    if (str[0] == 'V') {
+        token->literal = T_VX;
+        // by masking the token->value for Vx now, we can use it safely later
+        token->value = token_hex_value(str + 1, length - 1) & 0xF;
+    } else {
+        token->literal = T_NUM;
+        token->value = token_int_value(str, length);
+    }
+}
 
-    while (*str != '\0') {
-        Token* token = &instruction.args[instruction.arg_count++];
+// split the `length` bytes at `line` on spaces and classify each token
+Instruction token_extract_from_line(const char* line, size_t length) {
+    Instruction instruction = {0};
+    const char* end = line + length;
 
-        // skips non-spaces, fills trailing spaces with \0, returns pointer to start of next token
-        char* rest = token_next(str);
+    while (line < end) {
+        while (line < end && *line == ' ') line++;
+        if (line == end) break;
 
-        // printf("str: %s\n", str);
+        const char* start = line;
+        while (line < end && *line != ' ') line++;
 
-        if (strcmp(str, "call") == 0)      token->literal = T_CALL;
-        else if (strcmp(str, "cls") == 0)  token->literal = T_CLS;
-        else if (strcmp(str, "drw") == 0)  token->literal = T_DRW;
-        else if (strcmp(str, "jmp") == 0)  token->literal = T_JMP;
-        else if (strcmp(str, "jmp0") == 0) token->literal = T_JMP0;
-        else if (strcmp(str, "mov") == 0)  token->literal = T_MOV;
-        else if (strcmp(str, "rnd") == 0)  token->literal = T_RND;
-        else if (strcmp(str, "ret") == 0)  token->literal = T_RET;
-        else if (strcmp(str, "se") == 0)   token->literal = T_SE;
-        else if (strcmp(str, "sne") == 0)  token->literal = T_SNE;
-        else if (strcmp(str, "skp") == 0)  token->literal = T_SKP;
-        else if (strcmp(str, "sknp") == 0) token->literal = T_SKNP;
-        else if (strcmp(str, "add") == 0)  token->literal = T_ADD;
-        else if (strcmp(str, "sub") == 0)  token->literal = T_SUB;
-        else if (strcmp(str, "subn") == 0) token->literal = T_SUBN;
-        else if (strcmp(str, "and") == 0)  token->literal = T_AND;
-        else if (strcmp(str, "or") == 0)   token->literal = T_OR;
-        else if (strcmp(str, "xor") == 0)  token->literal = T_XOR;
-        else if (strcmp(str, "shr") == 0)  token->literal = T_SHR;
-        else if (strcmp(str, "shl") == 0)  token->literal = T_SHL;
-        else if (strcmp(str, "I") == 0)    token->literal = T_I;
-        else if (strcmp(str, "[I]") == 0)  token->literal = T_ADDR_I;
-        else if (strcmp(str, "K") == 0)    token->literal = T_K;
-        else if (strcmp(str, "B") == 0)    token->literal = T_B;
-        else if (strcmp(str, "DT") == 0)   token->literal = T_DT;
-        else if (strcmp(str, "ST") == 0)   token->literal = T_ST;
-        else if (strcmp(str, "F") == 0)    token->literal = T_F;
-        else {
-            if (str[0] == 'V') {
-                token->literal = T_VX;
-                // by masking the token->value for Vx now, we can use it safely later
-                token->value = strtol(str + 1, NULL, 16) & 0xF;
-            } else {
-                token->literal = T_NUM;
-                token->value = atoi(str);
-            }
+        // extra tokens are only counted (the argument count checks reject the line)
+        if (instruction.arg_count < 4) {
+            token_classify(&instruction.args[instruction.arg_count], start, line - start);
         }
-        str = rest;
+        if (instruction.arg_count < UINT8_MAX) instruction.arg_count++;
     }
-    free(start);
     return instruction;
 }
 
-Instruction token_parse_line(char* line) {
-    // returns an instruction with tokens extracted into args
-    Instruction ins = token_extract_from_line(line);
+// returns an instruction with tokens extracted into args
+Instruction token_parse_slice(const char* line, size_t length) {
+    Instruction ins = token_extract_from_line(line, length);
 
     Token* op = ins.args;
 
@@ -310,6 +472,11 @@ Instruction token_parse_line(char* line) {
                         ins.opcode = 0xF065 | (op[1].value << 8);
                         break;
                     }
+                    // mov Vx R
+                    case T_R: {
+                        ins.opcode = 0xF085 | (op[1].value << 8);
+                        break;
+                    }
                     default: assert(op[2].literal == T_INVALID && "Invalid argument type for 'mov'");
                 }
             } else if (op[1].literal == T_I) {
@@ -344,6 +511,16 @@ Instruction token_parse_line(char* line) {
                         ins.opcode = 0xF055 | (op[2].value << 8);
                         break;
                     }
+                    // mov HF Vx
+                    case T_HF: {
+                        ins.opcode = 0xF030 | (op[2].value << 8);
+                        break;
+                    }
+                    // mov R Vx
+                    case T_R: {
+                        ins.opcode = 0xF075 | (op[2].value << 8);
+                        break;
+                    }
                     default: assert(op[1].literal == T_INVALID && "Invalid argument type for 'mov'");
                 }
             } else {
@@ -462,12 +639,89 @@ Instruction token_parse_line(char* line) {
             assert(ins.arg_count >= 2 && "Invalid number of arguments for 'shr'");
             assert(op[1].literal == T_VX && "Invalid argument type for 'shr'");
             ins.opcode = 0x8006 | (op[1].value << 8);
+            // Vy is optional, the interpreter shifts Vx in place but the encoding keeps it
+            if (ins.arg_count >= 3 && op[2].literal == T_VX) ins.opcode |= op[2].value << 4;
             break;
         }
         case T_SHL: {
             assert(ins.arg_count >= 2 && "Invalid number of arguments for 'shl'");
             assert(op[1].literal == T_VX && "Invalid argument type for 'shl'");
             ins.opcode = 0x800E | (op[1].value << 8);
+            // Vy is optional, the interpreter shifts Vx in place but the encoding keeps it
+            if (ins.arg_count >= 3 && op[2].literal == T_VX) ins.opcode |= op[2].value << 4;
+            break;
+        }
+        case T_SCD: {
+            assert(ins.arg_count == 2 && "Invalid number of arguments for 'scd'");
+            assert(op[1].literal == T_NUM && "Invalid argument type for 'scd'");
+            ins.opcode = 0x00C0 | (op[1].value & 0xF);
+            break;
+        }
+        case T_SCR: {
+            assert(ins.arg_count == 1 && "Invalid number of arguments for 'scr'");
+            ins.opcode = 0x00FB;
+            break;
+        }
+        case T_SCL: {
+            assert(ins.arg_count == 1 && "Invalid number of arguments for 'scl'");
+            ins.opcode = 0x00FC;
+            break;
+        }
+        case T_EXIT: {
+            assert(ins.arg_count == 1 && "Invalid number of arguments for 'exit'");
+            ins.opcode = 0x00FD;
+            break;
+        }
+        case T_LOW: {
+            assert(ins.arg_count == 1 && "Invalid number of arguments for 'low'");
+            ins.opcode = 0x00FE;
+            break;
+        }
+        case T_HIGH: {
+            assert(ins.arg_count == 1 && "Invalid number of arguments for 'high'");
+            ins.opcode = 0x00FF;
+            break;
+        }
+        case T_SCU: {
+            assert(ins.arg_count == 2 && "Invalid number of arguments for 'scu'");
+            assert(op[1].literal == T_NUM && "Invalid argument type for 'scu'");
+            ins.opcode = 0x00D0 | (op[1].value & 0xF);
+            break;
+        }
+        case T_SAVE: {
+            assert(ins.arg_count == 3 && "Invalid number of arguments for 'save'");
+            assert(op[1].literal == T_VX && op[2].literal == T_VX && "Invalid argument type for 'save'");
+            ins.opcode = 0x5002 | (op[1].value << 8) | (op[2].value << 4);
+            break;
+        }
+        case T_LOAD: {
+            assert(ins.arg_count == 3 && "Invalid number of arguments for 'load'");
+            assert(op[1].literal == T_VX && op[2].literal == T_VX && "Invalid argument type for 'load'");
+            ins.opcode = 0x5003 | (op[1].value << 8) | (op[2].value << 4);
+            break;
+        }
+        case T_LONG: {
+            assert(ins.arg_count == 2 && "Invalid number of arguments for 'long'");
+            assert(op[1].literal == T_NUM && "Invalid argument type for 'long'");
+            ins.opcode = 0xF000;
+            ins.address = op[1].value & 0xFFFF;
+            break;
+        }
+        case T_PLANE: {
+            assert(ins.arg_count == 2 && "Invalid number of arguments for 'plane'");
+            assert(op[1].literal == T_NUM && "Invalid argument type for 'plane'");
+            ins.opcode = 0xF001 | ((op[1].value & 0xF) << 8);
+            break;
+        }
+        case T_AUDIO: {
+            assert(ins.arg_count == 1 && "Invalid number of arguments for 'audio'");
+            ins.opcode = 0xF002;
+            break;
+        }
+        case T_PITCH: {
+            assert(ins.arg_count == 2 && "Invalid number of arguments for 'pitch'");
+            assert(op[1].literal == T_VX && "Invalid argument type for 'pitch'");
+            ins.opcode = 0xF03A | (op[1].value << 8);
             break;
         }
         default: assert(op[0].literal == T_INVALID && "Invalid starting token");
@@ -476,4 +730,8 @@ Instruction token_parse_line(char* line) {
     return ins;
 }
 
+Instruction token_parse_line(const char* line) {
+    return token_parse_slice(line, strlen(line));
+}
+
 #endif //CHIP8_TOKEN_H
@@ -2,8 +2,14 @@
 #define CHIP8_UTIL_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define UTIL_INSTRUCTION_START 0x200 // where CHIP-8 programs start in memory
+#define UTIL_BIG_FONT_START 0x50     // SUPER-CHIP 8x10 digits, after the 16 small ones
 #define UTIL_INIT_CAP 256
 
 #define util_da_append(da, item)                                                   \
@@ -42,6 +48,19 @@ typedef struct {
   size_t capacity;
 } CString_List;
 
+#define UTIL_FNV_OFFSET 0xcbf29ce484222325ULL
+#define UTIL_FNV_PRIME 0x100000001b3ULL
+
+// 64-bit FNV-1a, chain calls by passing the previous hash (start with UTIL_FNV_OFFSET)
+uint64_t util_fnv1a(uint64_t hash, const void *data, size_t length) {
+  const uint8_t* bytes = data;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= UTIL_FNV_PRIME;
+  }
+  return hash;
+}
+
 bool util_read_file(const char *path, String *out) {
   FILE* file = fopen(path, "rb");
   if (file == NULL) return false;
@@ -84,4 +103,35 @@ bool util_write_file(const char *path, void *data, size_t length) {
   return true;
 }
 
+// map `path` read-only, an empty file maps to data = NULL, length = 0
+bool util_map_file(const char *path, const char **data, size_t *length) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    return false;
+  }
+
+  *data = NULL;
+  *length = info.st_size;
+  if (*length > 0) {
+    void* mapped = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(mapped, *length, MADV_SEQUENTIAL);
+    *data = mapped;
+  }
+
+  close(fd); // the mapping stays valid
+  return true;
+}
+
+void util_unmap_file(const char *data, size_t length) {
+  if (data != NULL) munmap((void*)data, length);
+}
+
 #endif //CHIP8_UTIL_H